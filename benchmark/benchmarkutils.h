@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX5_SKK_BENCHMARK_BENCHMARKUTILS_H_
+#define _FCITX5_SKK_BENCHMARK_BENCHMARKUTILS_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fcitx {
+
+// Writes data to path, creating its parent directories.
+inline bool writeFile(const std::filesystem::path &path,
+                      const std::string &data) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << data;
+    return out.good();
+}
+
+// Returns the nearest rank percentile p, in [0, 1], of sorted samples.
+inline double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+} // namespace fcitx
+
+#endif // _FCITX5_SKK_BENCHMARK_BENCHMARKUTILS_H_
@@ -0,0 +1,454 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+// Measures the latency of henkan against a server dictionary served by
+// skkserv-stub. Each reading is typed as romaji through the test frontend,
+// and the time from the key that starts the conversion until its input panel
+// update has run is recorded.
+//
+// Usage: skk-henkan-benchmark [--latency MS] [--jitter MS] [--drop RATE]
+//                             [--timeout MS] [--count N] [--encoding ENC]
+//                             [--cache SIZE] DICTIONARY
+
+#include <iconv.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcitx-utils/charutils.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/eventloopinterface.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/inputpanel.h>
+#include <fcitx/instance.h>
+#include "benchmarkdir.h"
+#include "benchmarkutils.h"
+#include "testfrontend_public.h"
+
+using namespace fcitx;
+
+namespace {
+
+struct Options {
+    int latency = 5;
+    int jitter = 0;
+    double drop = 0;
+    int timeout = 30;
+    int count = 1000;
+    int cache = 0;
+    std::string encoding = "EUC-JP";
+    std::string dictionary;
+};
+
+// Hiragana that can be typed with a single romaji sequence in the default
+// rule. Readings with anything else are skipped.
+const std::unordered_map<std::string_view, std::string_view> &romajiTable() {
+    static const std::unordered_map<std::string_view, std::string_view> table{
+        {"あ", "a"}, {"い", "i"}, {"う", "u"}, {"え", "e"}, {"お", "o"},
+        {"か", "ka"}, {"き", "ki"}, {"く", "ku"}, {"け", "ke"}, {"こ", "ko"},
+        {"さ", "sa"}, {"し", "si"}, {"す", "su"}, {"せ", "se"}, {"そ", "so"},
+        {"た", "ta"}, {"ち", "ti"}, {"つ", "tu"}, {"て", "te"}, {"と", "to"},
+        {"な", "na"}, {"に", "ni"}, {"ぬ", "nu"}, {"ね", "ne"}, {"の", "no"},
+        {"は", "ha"}, {"ひ", "hi"}, {"ふ", "hu"}, {"へ", "he"}, {"ほ", "ho"},
+        {"ま", "ma"}, {"み", "mi"}, {"む", "mu"}, {"め", "me"}, {"も", "mo"},
+        {"や", "ya"}, {"ゆ", "yu"}, {"よ", "yo"}, {"ら", "ra"}, {"り", "ri"},
+        {"る", "ru"}, {"れ", "re"}, {"ろ", "ro"}, {"わ", "wa"}, {"を", "wo"},
+        {"ん", "nn"}, {"が", "ga"}, {"ぎ", "gi"}, {"ぐ", "gu"}, {"げ", "ge"},
+        {"ご", "go"}, {"ざ", "za"}, {"じ", "zi"}, {"ず", "zu"}, {"ぜ", "ze"},
+        {"ぞ", "zo"}, {"だ", "da"}, {"ぢ", "di"}, {"づ", "du"}, {"で", "de"},
+        {"ど", "do"}, {"ば", "ba"}, {"び", "bi"}, {"ぶ", "bu"}, {"べ", "be"},
+        {"ぼ", "bo"}, {"ぱ", "pa"}, {"ぴ", "pi"}, {"ぷ", "pu"}, {"ぺ", "pe"},
+        {"ぽ", "po"},
+        {"きゃ", "kya"}, {"きゅ", "kyu"}, {"きょ", "kyo"}, {"しゃ", "sya"},
+        {"しゅ", "syu"}, {"しょ", "syo"}, {"ちゃ", "tya"}, {"ちゅ", "tyu"},
+        {"ちょ", "tyo"}, {"にゃ", "nya"}, {"にゅ", "nyu"}, {"にょ", "nyo"},
+        {"ひゃ", "hya"}, {"ひゅ", "hyu"}, {"ひょ", "hyo"}, {"みゃ", "mya"},
+        {"みゅ", "myu"}, {"みょ", "myo"}, {"りゃ", "rya"}, {"りゅ", "ryu"},
+        {"りょ", "ryo"}, {"ぎゃ", "gya"}, {"ぎゅ", "gyu"}, {"ぎょ", "gyo"},
+        {"じゃ", "zya"}, {"じゅ", "zyu"}, {"じょ", "zyo"}, {"びゃ", "bya"},
+        {"びゅ", "byu"}, {"びょ", "byo"}, {"ぴゃ", "pya"}, {"ぴゅ", "pyu"},
+        {"ぴょ", "pyo"},
+    };
+    return table;
+}
+
+// Convert a hiragana reading to romaji, returns nullopt if it contains
+// anything not in romajiTable().
+std::optional<std::string> toRomaji(std::string_view reading) {
+    constexpr std::string_view sokuon = "っ";
+    const auto &table = romajiTable();
+    std::string result;
+    bool doubleNext = false;
+    while (!reading.empty()) {
+        if (reading.starts_with(sokuon)) {
+            if (doubleNext || result.empty()) {
+                return std::nullopt;
+            }
+            doubleNext = true;
+            reading.remove_prefix(sokuon.size());
+            continue;
+        }
+        // Hiragana is 3 bytes in UTF-8, try the two character form first.
+        std::optional<std::string_view> romaji;
+        for (size_t length : {6, 3}) {
+            if (reading.size() < length) {
+                continue;
+            }
+            if (auto iter = table.find(reading.substr(0, length));
+                iter != table.end()) {
+                romaji = iter->second;
+                reading.remove_prefix(length);
+                break;
+            }
+        }
+        if (!romaji) {
+            return std::nullopt;
+        }
+        if (doubleNext) {
+            if (romaji->front() == 'a' || romaji->front() == 'i' ||
+                romaji->front() == 'u' || romaji->front() == 'e' ||
+                romaji->front() == 'o' || romaji->front() == 'n') {
+                return std::nullopt;
+            }
+            result.push_back(romaji->front());
+            doubleNext = false;
+        }
+        result.append(*romaji);
+    }
+    if (doubleNext || result.empty()) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+std::optional<std::string> toUTF8(const std::string &text,
+                                  const std::string &encoding) {
+    iconv_t conv = iconv_open("UTF-8", encoding.data());
+    if (conv == reinterpret_cast<iconv_t>(-1)) {
+        return std::nullopt;
+    }
+    std::string result(text.size() * 4, '\0');
+    char *in = const_cast<char *>(text.data());
+    size_t inLeft = text.size();
+    char *out = result.data();
+    size_t outLeft = result.size();
+    const bool success =
+        iconv(conv, &in, &inLeft, &out, &outLeft) != static_cast<size_t>(-1);
+    iconv_close(conv);
+    if (!success) {
+        return std::nullopt;
+    }
+    result.resize(result.size() - outLeft);
+    return result;
+}
+
+// Returns romaji of the okuri-nasi readings of the dictionary.
+std::vector<std::string> readReadings(const Options &options) {
+    std::vector<std::string> readings;
+    std::ifstream in(options.dictionary, std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line.front() == ';') {
+            continue;
+        }
+        auto space = line.find(" /");
+        if (space == std::string::npos || space == 0) {
+            continue;
+        }
+        auto midasi = toUTF8(line.substr(0, space), options.encoding);
+        if (!midasi) {
+            continue;
+        }
+        if (auto romaji = toRomaji(*midasi)) {
+            readings.push_back(std::move(*romaji));
+        }
+    }
+    return readings;
+}
+
+// Start skkserv-stub and return its pid and port.
+std::pair<pid_t, int> startServer(const Options &options) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return {-1, 0};
+    }
+    const auto latency = std::to_string(options.latency);
+    const auto jitter = std::to_string(options.jitter);
+    const auto drop = std::to_string(options.drop);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(SKKSERV_STUB_PATH, SKKSERV_STUB_PATH, "--latency",
+              latency.data(), "--jitter", jitter.data(), "--drop", drop.data(),
+              options.dictionary.data(), static_cast<char *>(nullptr));
+        _exit(1);
+    }
+    close(fds[1]);
+    std::string output;
+    char c;
+    while (read(fds[0], &c, 1) == 1 && c != '\n') {
+        output.push_back(c);
+    }
+    close(fds[0]);
+    if (pid < 0 || output.empty()) {
+        return {pid, 0};
+    }
+    return {pid, std::atoi(output.data())};
+}
+
+// Event loop iterations after a key, so the input panel update that skk
+// defers has run no matter which deferred event runs first.
+constexpr int drainSteps = 2;
+
+// Runs one step per event loop iteration, like test/testallocation.cpp, so
+// the deferred input panel update of each key runs before the next step.
+class HenkanBenchmark {
+public:
+    HenkanBenchmark(Instance *instance, const Options &options,
+                    const std::vector<std::string> &readings)
+        : instance_(instance), options_(options), readings_(readings) {}
+
+    void start() {
+        auto defaultGroup = instance_->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(InputMethodGroupItem("skk"));
+        defaultGroup.setDefaultInputMethod("");
+        instance_->inputMethodManager().setGroup(defaultGroup);
+
+        testfrontend_ = instance_->addonManager().addon("testfrontend");
+        uuid_ = testfrontend_->call<ITestFrontend::createInputContext>(
+            "benchmark");
+        ic_ = instance_->inputContextManager().findByUUID(uuid_);
+        FCITX_ASSERT(ic_);
+        testfrontend_->call<ITestFrontend::sendKeyEvent>(
+            uuid_, Key("Control+space"), false);
+        FCITX_ASSERT(instance_->inputMethod(ic_) == "skk");
+
+        step_ = instance_->eventLoop().addDeferEvent([this](EventSource *) {
+            runStep();
+            return true;
+        });
+    }
+
+private:
+    enum class Phase { Type, Convert, Check };
+
+    void runStep() {
+        if (drain_ > 0) {
+            drain_ -= 1;
+            step_->setOneShot();
+            return;
+        }
+        switch (phase_) {
+        case Phase::Type:
+            if (static_cast<int>(samples_.size()) == options_.count) {
+                finish();
+                return;
+            }
+            typeReading();
+            phase_ = Phase::Convert;
+            break;
+        case Phase::Convert:
+            start_ = std::chrono::steady_clock::now();
+            testfrontend_->call<ITestFrontend::sendKeyEvent>(
+                uuid_, Key("space"), false);
+            phase_ = Phase::Check;
+            break;
+        case Phase::Check:
+            check();
+            phase_ = Phase::Type;
+            break;
+        }
+        drain_ = drainSteps;
+        step_->setOneShot();
+    }
+
+    void typeReading() {
+        const auto &romaji = readings_[random_() % readings_.size()];
+        // Upper case letter starts the reading.
+        for (size_t j = 0; j < romaji.size(); j++) {
+            char c = romaji[j];
+            if (j == 0) {
+                c = charutils::toupper(c);
+            }
+            testfrontend_->call<ITestFrontend::sendKeyEvent>(
+                uuid_, Key(std::string(1, c)), false);
+        }
+    }
+
+    // The sample ends once the input panel of the conversion is updated.
+    void check() {
+        const auto end = std::chrono::steady_clock::now();
+        samples_.push_back(
+            std::chrono::duration<double, std::milli>(end - start_).count());
+
+        // A conversion with candidate shows "▼", otherwise it goes to
+        // registration.
+        const auto preedit = ic_->inputPanel().clientPreedit().toString() +
+                             ic_->inputPanel().preedit().toString();
+        if (preedit.find("▼") == std::string::npos) {
+            missed_ += 1;
+        }
+        ic_->reset();
+    }
+
+    void finish() {
+        std::sort(samples_.begin(), samples_.end());
+        double total = 0;
+        for (auto sample : samples_) {
+            total += sample;
+        }
+        std::cout << "conversions: " << samples_.size() << std::endl
+                  << "without candidate: " << missed_ << std::endl
+                  << "mean: " << total / samples_.size() << " ms"
+                  << std::endl
+                  << "p50: " << percentile(samples_, 0.5) << " ms"
+                  << std::endl
+                  << "p99: " << percentile(samples_, 0.99) << " ms"
+                  << std::endl
+                  << "max: " << samples_.back() << " ms" << std::endl;
+        instance_->exit();
+    }
+
+    Instance *instance_;
+    const Options &options_;
+    const std::vector<std::string> &readings_;
+    AddonInstance *testfrontend_ = nullptr;
+    ICUUID uuid_;
+    InputContext *ic_ = nullptr;
+    std::unique_ptr<EventSource> step_;
+    Phase phase_ = Phase::Type;
+    int drain_ = 0;
+    std::mt19937 random_{0};
+    std::chrono::steady_clock::time_point start_;
+    std::vector<double> samples_;
+    int missed_ = 0;
+};
+
+void usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0
+              << " [--latency MS] [--jitter MS] [--drop RATE] [--timeout MS] "
+                 "[--count N] [--encoding ENC] [--cache SIZE] DICTIONARY"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (i + 1 < argc && arg == "--latency") {
+            options.latency = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--jitter") {
+            options.jitter = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--drop") {
+            options.drop = std::atof(argv[++i]);
+        } else if (i + 1 < argc && arg == "--timeout") {
+            options.timeout = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--count") {
+            options.count = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--encoding") {
+            options.encoding = argv[++i];
+        } else if (i + 1 < argc && arg == "--cache") {
+            options.cache = std::atoi(argv[++i]);
+        } else if (!arg.starts_with("--") && options.dictionary.empty()) {
+            options.dictionary = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.dictionary.empty() || options.count <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const auto readings = readReadings(options);
+    if (readings.empty()) {
+        std::cerr << "No usable reading in " << options.dictionary
+                  << std::endl;
+        return 1;
+    }
+
+    auto [pid, port] = startServer(options);
+    if (port <= 0) {
+        std::cerr << "Failed to start skkserv-stub." << std::endl;
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+        return 1;
+    }
+
+    char tempDir[] = "/tmp/skk-benchmark-XXXXXX";
+    if (!mkdtemp(tempDir)) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+        return 1;
+    }
+    const std::filesystem::path home = tempDir;
+    writeFile(home / "skk/dictionary_list",
+              "type=server,host=127.0.0.1,port=" + std::to_string(port) +
+                  ",encoding=" + options.encoding +
+                  ",timeout=" + std::to_string(options.timeout) + "\n");
+    writeFile(home / "conf/skk.conf",
+              "LoadDictionaryInBackground=False\nLookupCacheSize=" +
+                  std::to_string(options.cache) + "\n");
+
+    setupTestingEnvironment(BENCHMARK_BINARY_DIR, {SKK_ADDON_DIR},
+                            {BENCHMARK_BINARY_DIR});
+    // Configuration and dictionary_list are read from the temporary home.
+    setenv("FCITX_CONFIG_HOME", tempDir, 1);
+    setenv("FCITX_DATA_HOME", tempDir, 1);
+    Log::setLogRule("default=3");
+
+    char arg0[] = "skk-henkan-benchmark";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,skk";
+    char *instanceArgv[] = {arg0, arg1, arg2};
+    Instance instance(FCITX_ARRAY_SIZE(instanceArgv), instanceArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    EventDispatcher dispatcher;
+    dispatcher.attach(&instance.eventLoop());
+    HenkanBenchmark benchmark(&instance, options, readings);
+    dispatcher.schedule([&instance, &benchmark]() {
+        FCITX_ASSERT(instance.addonManager().addon("skk", true));
+        benchmark.start();
+    });
+    instance.exec();
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    std::error_code ec;
+    std::filesystem::remove_all(home, ec);
+    return 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+// Replays a script of key sequences through skk with the test frontend and
+// reports the throughput, the latency of each key press and the allocations
+// per key. See replay.keys for the script format.
+//
+// Usage: skk-replay-benchmark [--rule RULE] [--dictionary-list FILE]
+//                             [--repeat N] [--config LINE] [SCRIPT]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx-utils/utf8.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+#include "benchmarkdir.h"
+#include "benchmarkutils.h"
+#include "config.h"
+#include "skk_public.h"
+#include "testfrontend_public.h"
+
+using namespace fcitx;
+
+namespace {
+
+// Every malloc of the process, including the ones of glib and libskk, is
+// counted by the wrappers below.
+std::atomic<uint64_t> allocations{0};
+
+} // namespace
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+
+namespace {
+
+struct Options {
+    std::string rule = "default";
+    std::string dictionaryList;
+    int repeat = 100;
+    std::vector<std::string> config;
+    std::string script = REPLAY_SCRIPT_PATH;
+};
+
+struct Step {
+    enum class Type { Key, Reset };
+    Type type;
+    Key key;
+};
+
+// Returns the steps of the script, or an empty list if it has an error.
+std::vector<Step> readScript(const std::string &path) {
+    std::vector<Step> steps;
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return {};
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber += 1;
+        std::istringstream words(line);
+        std::string command;
+        if (!(words >> command) || command.starts_with('#')) {
+            continue;
+        }
+        bool valid = true;
+        std::string word;
+        if (command == "type") {
+            valid = static_cast<bool>(words >> word) &&
+                    utf8::validate(word);
+            if (valid) {
+                for (auto chr : utf8::MakeUTF8CharRange(word)) {
+                    steps.push_back(
+                        {Step::Type::Key, Key(Key::keySymFromUnicode(chr))});
+                }
+            }
+        } else if (command == "key") {
+            while (valid && words >> word) {
+                Key key(word);
+                valid = key.isValid();
+                steps.push_back({Step::Type::Key, key});
+            }
+        } else if (command == "reset") {
+            steps.push_back({Step::Type::Reset, Key()});
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            std::cerr << path << ":" << lineNumber << ": invalid line: " << line
+                      << std::endl;
+            return {};
+        }
+    }
+    return steps;
+}
+
+// Sends one step per event loop iteration, so the input panel update that
+// skk defers to the event loop runs between keys like it does for a user.
+class Replay {
+public:
+    Replay(Instance *instance, EventDispatcher *dispatcher,
+           const Options &options, const std::vector<Step> &script)
+        : instance_(instance), dispatcher_(dispatcher), options_(options),
+          script_(script) {}
+
+    void start() {
+        auto defaultGroup = instance_->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(InputMethodGroupItem("skk"));
+        defaultGroup.setDefaultInputMethod("");
+        instance_->inputMethodManager().setGroup(defaultGroup);
+
+        testfrontend_ = instance_->addonManager().addon("testfrontend");
+        skk_ = instance_->addonManager().addon("skk");
+        uuid_ = testfrontend_->call<ITestFrontend::createInputContext>(
+            "benchmark");
+        ic_ = instance_->inputContextManager().findByUUID(uuid_);
+        FCITX_ASSERT(ic_);
+        testfrontend_->call<ITestFrontend::sendKeyEvent>(
+            uuid_, Key("Control+space"), false);
+        FCITX_ASSERT(instance_->inputMethod(ic_) == "skk");
+
+        // The first round warms up the caches of skk and libskk and is not
+        // measured.
+        scheduleStep();
+    }
+
+private:
+    void scheduleStep() {
+        dispatcher_->schedule([this]() { runStep(); });
+    }
+
+    void runStep() {
+        if (index_ == script_.size()) {
+            index_ = 0;
+            ic_->reset();
+            if (round_ == 0) {
+                skk_->call<ISkkEngine::resetKeyStatistics>();
+                allocations.store(0, std::memory_order_relaxed);
+                start_ = std::chrono::steady_clock::now();
+            }
+            round_ += 1;
+            if (round_ > options_.repeat) {
+                finish();
+                return;
+            }
+        }
+
+        const auto &step = script_[index_++];
+        if (step.type == Step::Type::Reset) {
+            ic_->reset();
+        } else {
+            // Only the press is timed, the release is sent outside of the
+            // sample so it does not add its own latency to it.
+            const auto start = std::chrono::steady_clock::now();
+            testfrontend_->call<ITestFrontend::sendKeyEvent>(uuid_, step.key,
+                                                             false);
+            const auto end = std::chrono::steady_clock::now();
+            testfrontend_->call<ITestFrontend::sendKeyEvent>(uuid_, step.key,
+                                                             true);
+            if (round_ > 0) {
+                samples_.push_back(
+                    std::chrono::duration<double, std::micro>(end - start)
+                        .count());
+            }
+        }
+        scheduleStep();
+    }
+
+    void finish() {
+        const auto elapsed = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start_)
+                                 .count();
+        const auto allocated = allocations.load(std::memory_order_relaxed);
+        std::sort(samples_.begin(), samples_.end());
+        std::cout << "keys: " << samples_.size() << std::endl
+                  << "keys/sec: " << samples_.size() / elapsed << std::endl
+                  << "press p50: " << percentile(samples_, 0.5) << " us"
+                  << std::endl
+                  << "press p99: " << percentile(samples_, 0.99) << " us"
+                  << std::endl
+                  << "press p999: " << percentile(samples_, 0.999) << " us"
+                  << std::endl
+                  << "press max: " << samples_.back() << " us" << std::endl
+                  << "allocations/key (press and release): "
+                  << static_cast<double>(allocated) / samples_.size()
+                  << std::endl;
+        // The latency above is the key press itself, the deferred input
+        // panel update is only in the updateUI phase of skk.
+        std::cout << skk_->call<ISkkEngine::keyStatistics>() << std::endl;
+        instance_->exit();
+    }
+
+    Instance *instance_;
+    EventDispatcher *dispatcher_;
+    const Options &options_;
+    const std::vector<Step> &script_;
+    AddonInstance *testfrontend_ = nullptr;
+    AddonInstance *skk_ = nullptr;
+    ICUUID uuid_;
+    InputContext *ic_ = nullptr;
+    size_t index_ = 0;
+    int round_ = 0;
+    std::chrono::steady_clock::time_point start_;
+    std::vector<double> samples_;
+};
+
+void usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0
+              << " [--rule RULE] [--dictionary-list FILE] [--repeat N] "
+                 "[--config LINE] [SCRIPT]"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    bool hasScript = false;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (i + 1 < argc && arg == "--rule") {
+            options.rule = argv[++i];
+        } else if (i + 1 < argc && arg == "--dictionary-list") {
+            options.dictionaryList = argv[++i];
+        } else if (i + 1 < argc && arg == "--repeat") {
+            options.repeat = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--config") {
+            options.config.push_back(argv[++i]);
+        } else if (!arg.starts_with("--") && !hasScript) {
+            options.script = arg;
+            hasScript = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.repeat <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const auto script = readScript(options.script);
+    if (std::none_of(script.begin(), script.end(), [](const Step &step) {
+            return step.type == Step::Type::Key;
+        })) {
+        std::cerr << "No key in " << options.script << std::endl;
+        return 1;
+    }
+
+    std::string dictionaryList;
+    if (options.dictionaryList.empty()) {
+        // The user dictionary is in the temporary home, so what is learned
+        // does not leak into the next run.
+        dictionaryList = "type=file,file=$FCITX_CONFIG_DIR/skk/user.dict,"
+                         "mode=readwrite\n"
+                         "type=file,file=" SKK_PATH "/SKK-JISYO.L,"
+                         "mode=readonly\n";
+    } else {
+        std::ifstream in(options.dictionaryList);
+        if (!in) {
+            std::cerr << "Failed to open " << options.dictionaryList
+                      << std::endl;
+            return 1;
+        }
+        dictionaryList.assign(std::istreambuf_iterator<char>(in), {});
+    }
+
+    char tempDir[] = "/tmp/skk-benchmark-XXXXXX";
+    if (!mkdtemp(tempDir)) {
+        return 1;
+    }
+    const std::filesystem::path home = tempDir;
+    writeFile(home / "skk/dictionary_list", dictionaryList);
+    std::string config = "LoadDictionaryInBackground=False\nRule=" +
+                         options.rule + "\n";
+    for (const auto &line : options.config) {
+        config += line + "\n";
+    }
+    writeFile(home / "conf/skk.conf", config);
+
+    setupTestingEnvironment(BENCHMARK_BINARY_DIR, {SKK_ADDON_DIR},
+                            {BENCHMARK_BINARY_DIR});
+    // Configuration and dictionary_list are read from the temporary home.
+    setenv("FCITX_CONFIG_HOME", tempDir, 1);
+    setenv("FCITX_DATA_HOME", tempDir, 1);
+    Log::setLogRule("default=3");
+
+    char arg0[] = "skk-replay-benchmark";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,skk";
+    char *instanceArgv[] = {arg0, arg1, arg2};
+    Instance instance(FCITX_ARRAY_SIZE(instanceArgv), instanceArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    EventDispatcher dispatcher;
+    dispatcher.attach(&instance.eventLoop());
+    Replay replay(&instance, &dispatcher, options, script);
+    dispatcher.schedule([&instance, &replay]() {
+        FCITX_ASSERT(instance.addonManager().addon("skk", true));
+        replay.start();
+    });
+    instance.exec();
+
+    std::error_code ec;
+    std::filesystem::remove_all(home, ec);
+    return 0;
+}
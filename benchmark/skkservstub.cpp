@@ -0,0 +1,238 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+// A skkserv that serves a SKK-JISYO style dictionary file with injected
+// latency, jitter and dropped answers, for benchmarking the server
+// dictionary. The bound port is printed to stdout once it is ready.
+//
+// Usage: skkserv-stub [--port N] [--latency MS] [--jitter MS] [--drop RATE]
+//                     DICTIONARY
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+struct Options {
+    int port = 0;
+    int latency = 0;
+    int jitter = 0;
+    double drop = 0;
+    std::string dictionary;
+};
+
+class Server {
+public:
+    Server(const Options &options) : options_(options) {}
+
+    bool load() {
+        std::ifstream in(options_.dictionary, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line.front() == ';') {
+                continue;
+            }
+            auto space = line.find(" /");
+            if (space == std::string::npos || space == 0) {
+                continue;
+            }
+            entries_.try_emplace(line.substr(0, space), line.substr(space + 1));
+        }
+        return true;
+    }
+
+    void serve(int fd) {
+        std::string buffer;
+        char data[4096];
+        while (true) {
+            auto length = recv(fd, data, sizeof(data), 0);
+            if (length <= 0) {
+                break;
+            }
+            buffer.append(data, length);
+            while (!buffer.empty()) {
+                // Lookup and completion requests end with a space, others
+                // are a single character. A line break some clients send
+                // after the space is ignored as an unknown command.
+                std::string request;
+                if (buffer.front() == '1' || buffer.front() == '4') {
+                    auto end = buffer.find(' ');
+                    if (end == std::string::npos) {
+                        break;
+                    }
+                    request = buffer.substr(0, end);
+                    buffer.erase(0, end + 1);
+                } else {
+                    request = buffer.substr(0, 1);
+                    buffer.erase(0, 1);
+                }
+                if (!handle(fd, request)) {
+                    close(fd);
+                    return;
+                }
+            }
+        }
+        close(fd);
+    }
+
+private:
+    bool handle(int fd, std::string_view request) {
+        switch (request.front()) {
+        case '0':
+            return false;
+        case '1': {
+            delay();
+            if (shouldDrop()) {
+                return true;
+            }
+            auto midasi = request.substr(1);
+            auto iter = entries_.find(std::string(midasi));
+            if (iter == entries_.end()) {
+                return reply(fd, std::string("4") + std::string(midasi) + "\n");
+            }
+            return reply(fd, "1" + iter->second + "\n");
+        }
+        case '2':
+            return reply(fd, "skkserv-stub.0.1 ");
+        case '3':
+            return reply(fd, "localhost:127.0.0.1: ");
+        case '4':
+            // Completion is not supported.
+            return reply(fd, "4\n");
+        default:
+            return true;
+        }
+    }
+
+    void delay() {
+        int latency = options_.latency;
+        if (options_.jitter > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            latency += std::uniform_int_distribution<int>(
+                -options_.jitter, options_.jitter)(random_);
+        }
+        if (latency > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(latency));
+        }
+    }
+
+    bool shouldDrop() {
+        if (options_.drop <= 0) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::uniform_real_distribution<double>(0, 1)(random_) <
+               options_.drop;
+    }
+
+    static bool reply(int fd, std::string_view data) {
+        while (!data.empty()) {
+            auto written = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (written <= 0) {
+                return false;
+            }
+            data.remove_prefix(written);
+        }
+        return true;
+    }
+
+    const Options &options_;
+    std::unordered_map<std::string, std::string> entries_;
+    std::mutex mutex_;
+    std::mt19937 random_{std::random_device()()};
+};
+
+void usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0
+              << " [--port N] [--latency MS] [--jitter MS] [--drop RATE] "
+                 "DICTIONARY"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (i + 1 < argc && arg == "--port") {
+            options.port = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--latency") {
+            options.latency = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--jitter") {
+            options.jitter = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--drop") {
+            options.drop = std::atof(argv[++i]);
+        } else if (!arg.starts_with("--") && options.dictionary.empty()) {
+            options.dictionary = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.dictionary.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Server server(options);
+    if (!server.load()) {
+        std::cerr << "Failed to read " << options.dictionary << std::endl;
+        return 1;
+    }
+
+    int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(options.port);
+    socklen_t length = sizeof(addr);
+    if (bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr),
+             sizeof(addr)) != 0 ||
+        listen(listenFd, 16) != 0 ||
+        getsockname(listenFd, reinterpret_cast<struct sockaddr *>(&addr),
+                    &length) != 0) {
+        std::cerr << "Failed to listen: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::cout << ntohs(addr.sin_port) << std::endl;
+
+    while (true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        std::thread(&Server::serve, &server, fd).detach();
+    }
+    close(listenFd);
+    return 0;
+}
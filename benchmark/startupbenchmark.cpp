@@ -0,0 +1,410 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+// Measures the time to load the skk addon, which constructs SkkEngine and
+// loads the dictionaries, the time of reloadConfig(), and the peak RSS, for
+// a set of dictionary_list setups. The dictionaries are generated, so it
+// runs offline and every run sees the same data. Each measurement is done
+// in a new process, so the peak RSS and the caches of one case do not leak
+// into another.
+//
+// Usage: skk-startup-benchmark [--repeat N] [--background] [--filter TEXT]
+
+#include <iconv.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/instance.h>
+#include "benchmarkdir.h"
+#include "benchmarkutils.h"
+#include "dictcache.h"
+
+using namespace fcitx;
+
+namespace {
+
+struct Options {
+    int repeat = 5;
+    bool background = false;
+    std::string filter;
+};
+
+struct Case {
+    std::string name;
+    std::string dictionaryList;
+    // Remove the compiled dictionaries before each run.
+    bool cold = false;
+};
+
+struct Result {
+    double construct = 0;
+    double reload = 0;
+    long maxRss = 0;
+};
+
+// Kanji of JIS X 0208 level 1, so they can be written in EUC-JP.
+constexpr std::string_view kanji[] = {
+    "日", "本", "語", "漢", "字", "変", "換", "入", "力", "辞", "書", "文",
+    "会", "社", "学", "校", "電", "車", "時", "間", "自", "分", "今", "明",
+    "先", "生", "大", "東", "京", "世", "界", "国", "家", "政", "治", "経",
+    "済", "化", "技", "術", "情", "報", "山", "川", "花", "鳥", "風", "月",
+};
+
+constexpr std::string_view hiragana[] = {
+    "あ", "い", "う", "え", "お", "か", "き", "く", "け", "こ", "さ", "し",
+    "す", "せ", "そ", "た", "ち", "つ", "て", "と", "な", "に", "ぬ", "ね",
+    "の", "は", "ひ", "ふ", "へ", "ほ", "ま", "み", "む", "め", "も", "や",
+    "ゆ", "よ", "ら", "り", "る", "れ", "ろ", "わ", "を", "ん",
+};
+
+std::optional<std::string> convert(std::string_view text,
+                                   const std::string &encoding) {
+    if (encoding == "UTF-8") {
+        return std::string(text);
+    }
+    iconv_t conv = iconv_open(encoding.data(), "UTF-8");
+    if (conv == reinterpret_cast<iconv_t>(-1)) {
+        return std::nullopt;
+    }
+    std::string result(text.size() * 2 + 1, '\0');
+    char *in = const_cast<char *>(text.data());
+    size_t inLeft = text.size();
+    char *out = result.data();
+    size_t outLeft = result.size();
+    const bool success =
+        iconv(conv, &in, &inLeft, &out, &outLeft) != static_cast<size_t>(-1);
+    iconv_close(conv);
+    if (!success) {
+        return std::nullopt;
+    }
+    result.resize(result.size() - outLeft);
+    return result;
+}
+
+// Reading of the index-th entry, every index gives a distinct reading of at
+// least two characters.
+std::string reading(size_t index) {
+    constexpr size_t base = FCITX_ARRAY_SIZE(hiragana);
+    std::string result;
+    for (size_t value = index + base + 1; value > 0;
+         value = (value - 1) / base) {
+        result.insert(0, hiragana[(value - 1) % base]);
+    }
+    return result;
+}
+
+// Write a SKK-JISYO style dictionary with the given number of entries, one
+// in eight of them okuri-ari. Sections are sorted like a real dictionary in
+// the byte order of the encoding.
+bool generateDictionary(const std::filesystem::path &path, size_t entries,
+                        const std::string &encoding) {
+    constexpr size_t numKanji = FCITX_ARRAY_SIZE(kanji);
+    std::vector<std::string> okuriAri;
+    std::vector<std::string> okuriNasi;
+    for (size_t i = 0; i < entries; i++) {
+        const bool okuri = i % 8 == 0;
+        std::string line = reading(i);
+        if (okuri) {
+            line.push_back('k');
+        }
+        line.append(" /");
+        for (size_t j = 0, count = 1 + (i % 4); j < count; j++) {
+            line.append(kanji[(i + j * 7) % numKanji]);
+            line.append(kanji[(i / numKanji + j) % numKanji]);
+            line.push_back('/');
+        }
+        auto converted = convert(line, encoding);
+        if (!converted) {
+            return false;
+        }
+        (okuri ? okuriAri : okuriNasi).push_back(std::move(*converted));
+    }
+    std::sort(okuriAri.begin(), okuriAri.end(), std::greater<>());
+    std::sort(okuriNasi.begin(), okuriNasi.end());
+
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << ";; -*- mode: fundamental; coding: " << encoding << " -*-\n"
+        << ";; okuri-ari entries.\n";
+    for (const auto &line : okuriAri) {
+        out << line << '\n';
+    }
+    out << ";; okuri-nasi entries.\n";
+    for (const auto &line : okuriNasi) {
+        out << line << '\n';
+    }
+    return out.good();
+}
+
+std::string fileEntry(const std::filesystem::path &path,
+                      const std::string &mode,
+                      const std::string &encoding = "EUC-JP") {
+    return "type=file,file=" + path.string() + ",mode=" + mode +
+           ",encoding=" + encoding + "\n";
+}
+
+// Generate the dictionaries under directory and return the cases using
+// them.
+std::vector<Case> prepareCases(const std::filesystem::path &directory) {
+    const auto jisyoS = directory / "SKK-JISYO.S";
+    const auto jisyoM = directory / "SKK-JISYO.M";
+    const auto jisyoL = directory / "SKK-JISYO.L";
+    const auto jisyoLCdb = directory / "SKK-JISYO.L.cdb";
+    // Roughly the number of entries of the real dictionaries.
+    const std::pair<std::filesystem::path, size_t> systemDictionaries[] = {
+        {jisyoS, 4000},
+        {jisyoM, 90000},
+        {jisyoL, 170000},
+    };
+    for (const auto &[path, entries] : systemDictionaries) {
+        std::cerr << "Generating " << path.filename().string() << std::endl;
+        if (!generateDictionary(path, entries, "EUC-JP")) {
+            return {};
+        }
+    }
+    if (!compileDictionaryToCdb(jisyoL.string(), "EUC-JP", jisyoLCdb)) {
+        return {};
+    }
+
+    std::vector<Case> cases;
+    cases.push_back({"empty", "", false});
+    for (const auto &[path, _] : systemDictionaries) {
+        const auto name = path.filename().string();
+        const auto entry = fileEntry(path, "readonly");
+        cases.push_back({name + " cold", entry, true});
+        cases.push_back({name + " warm", entry, false});
+    }
+    cases.push_back({"SKK-JISYO.L.cdb",
+                     fileEntry(jisyoLCdb, "readonly", "UTF-8"), false});
+    cases.push_back(
+        {"SKK-JISYO.L mmap",
+         "type=mmap,file=" + jisyoL.string() + ",encoding=EUC-JP\n", false});
+
+    for (size_t entries : {1000, 10000, 100000, 500000}) {
+        const auto path =
+            directory / ("user-" + std::to_string(entries / 1000) + "k.dict");
+        std::cerr << "Generating " << path.filename().string() << std::endl;
+        if (!generateDictionary(path, entries, "UTF-8")) {
+            return {};
+        }
+        cases.push_back({"user " + std::to_string(entries / 1000) + "k",
+                         fileEntry(path, "readwrite", "UTF-8"), false});
+    }
+
+    cases.push_back(
+        {"stacked",
+         fileEntry(directory / "user-100k.dict", "readwrite", "UTF-8") +
+             fileEntry(jisyoL, "readonly") + fileEntry(jisyoM, "readonly") +
+             fileEntry(jisyoS, "readonly"),
+         false});
+    return cases;
+}
+
+// Runs in the child process. Loads the addon with the configuration in home
+// and prints the result.
+int measure(const char *home) {
+    setupTestingEnvironment(BENCHMARK_BINARY_DIR, {SKK_ADDON_DIR},
+                            {BENCHMARK_BINARY_DIR});
+    setenv("FCITX_CONFIG_HOME", home, 1);
+    setenv("FCITX_DATA_HOME", home, 1);
+    Log::setLogRule("default=3");
+
+    char arg0[] = "skk-startup-benchmark";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,skk";
+    char *instanceArgv[] = {arg0, arg1, arg2};
+    Instance instance(FCITX_ARRAY_SIZE(instanceArgv), instanceArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    EventDispatcher dispatcher;
+    dispatcher.attach(&instance.eventLoop());
+    Result result;
+    dispatcher.schedule([&instance, &result]() {
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        auto *skk = instance.addonManager().addon("skk", true);
+        FCITX_ASSERT(skk);
+        const auto loaded = Clock::now();
+        skk->reloadConfig();
+        const auto reloaded = Clock::now();
+        result.construct =
+            std::chrono::duration<double, std::milli>(loaded - start).count();
+        result.reload =
+            std::chrono::duration<double, std::milli>(reloaded - loaded)
+                .count();
+        instance.exit();
+    });
+    instance.exec();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << result.construct << " " << result.reload << " "
+              << usage.ru_maxrss << std::endl;
+    return 0;
+}
+
+// Run measure() in a new process, so it starts with nothing loaded.
+std::optional<Result> runChild(const std::filesystem::path &home) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return std::nullopt;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("/proc/self/exe", "skk-startup-benchmark", "--measure",
+              home.c_str(), static_cast<char *>(nullptr));
+        _exit(1);
+    }
+    close(fds[1]);
+    std::string output;
+    char buffer[256];
+    ssize_t length;
+    while ((length = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        output.append(buffer, length);
+    }
+    close(fds[0]);
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        return std::nullopt;
+    }
+    Result result;
+    if (std::sscanf(output.data(), "%lf %lf %ld", &result.construct,
+                    &result.reload, &result.maxRss) != 3) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+template <typename T>
+T median(std::vector<T> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+void usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0
+              << " [--repeat N] [--background] [--filter TEXT]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && std::string_view(argv[1]) == "--measure") {
+        return measure(argv[2]);
+    }
+
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (i + 1 < argc && arg == "--repeat") {
+            options.repeat = std::atoi(argv[++i]);
+        } else if (arg == "--background") {
+            options.background = true;
+        } else if (i + 1 < argc && arg == "--filter") {
+            options.filter = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.repeat <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char tempDir[] = "/tmp/skk-benchmark-XXXXXX";
+    if (!mkdtemp(tempDir)) {
+        return 1;
+    }
+    const std::filesystem::path root = tempDir;
+    const auto cases = prepareCases(root / "dictionaries");
+    if (cases.empty()) {
+        std::cerr << "Failed to generate dictionaries." << std::endl;
+        std::error_code ec;
+        std::filesystem::remove_all(root, ec);
+        return 1;
+    }
+
+    // The loader thread is not waited for when loading in background, so
+    // only the part blocking the event loop is measured.
+    const std::string config =
+        options.background ? "LoadDictionaryInBackground=True\n"
+                           : "LoadDictionaryInBackground=False\n";
+    std::cout << std::left << std::setw(24) << "case" << std::right
+              << std::setw(14) << "startup (ms)" << std::setw(14)
+              << "reload (ms)" << std::setw(16) << "peak RSS (MB)"
+              << std::endl;
+    int failed = 0;
+    for (size_t i = 0; i < cases.size(); i++) {
+        const auto &benchmarkCase = cases[i];
+        if (benchmarkCase.name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        const auto home = root / ("home-" + std::to_string(i));
+        writeFile(home / "conf/skk.conf", config);
+        writeFile(home / "skk/dictionary_list", benchmarkCase.dictionaryList);
+
+        std::vector<double> construct;
+        std::vector<double> reload;
+        std::vector<long> maxRss;
+        // The first run is not measured, it fills the page cache and, for a
+        // warm case, builds the compiled dictionaries.
+        for (int run = -1; run < options.repeat; run++) {
+            if (benchmarkCase.cold) {
+                std::error_code ec;
+                std::filesystem::remove_all(home / "skk/cache", ec);
+            }
+            auto result = runChild(home);
+            if (!result) {
+                break;
+            }
+            if (run < 0) {
+                continue;
+            }
+            construct.push_back(result->construct);
+            reload.push_back(result->reload);
+            maxRss.push_back(result->maxRss);
+        }
+        if (construct.size() != static_cast<size_t>(options.repeat)) {
+            std::cout << std::left << std::setw(24) << benchmarkCase.name
+                      << " failed" << std::endl;
+            failed += 1;
+            continue;
+        }
+        std::cout << std::left << std::setw(24) << benchmarkCase.name
+                  << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(14) << median(construct) << std::setw(14)
+                  << median(reload) << std::setw(16)
+                  << median(maxRss) / 1024.0 << std::endl;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    return failed ? 1 : 0;
+}
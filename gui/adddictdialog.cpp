@@ -29,7 +29,12 @@
 
 namespace fcitx {
 
-enum DictType { DictType_System, DictType_User, DictType_Server };
+enum DictType {
+    DictType_System,
+    DictType_User,
+    DictType_Server,
+    DictType_MappedSystem
+};
 
 AddDictDialog::AddDictDialog(QWidget *parent)
     : QDialog(parent), m_ui(std::make_unique<Ui::AddDictDialog>()) {
@@ -37,6 +42,7 @@ AddDictDialog::AddDictDialog(QWidget *parent)
     m_ui->typeComboBox->addItem(_("System"));
     m_ui->typeComboBox->addItem(_("User"));
     m_ui->typeComboBox->addItem(_("Server"));
+    m_ui->typeComboBox->addItem(_("System (Memory mapped)"));
 
     indexChanged(0);
 
@@ -54,13 +60,18 @@ AddDictDialog::AddDictDialog(QWidget *parent)
 QMap<QString, QString> AddDictDialog::dictionary() {
     int idx = m_ui->typeComboBox->currentIndex();
     idx = idx < 0 ? 0 : idx;
-    idx = idx > 2 ? 0 : idx;
+    idx = idx > 3 ? 0 : idx;
 
     QMap<QString, QString> dict;
     if (idx == DictType_Server) {
         dict["type"] = "server";
         dict["host"] = m_ui->hostLineEdit->text();
         dict["port"] = QString("%1").arg(m_ui->portSpinBox->value());
+        dict["timeout"] = QString("%1").arg(m_ui->timeoutSpinBox->value());
+    } else if (idx == DictType_MappedSystem) {
+        dict["type"] = "mmap";
+        dict["file"] = m_ui->urlLineEdit->text();
+        dict["mode"] = "readonly";
     } else {
         const char *type[] = {"readonly", "readwrite"};
 
@@ -84,6 +95,8 @@ void AddDictDialog::indexChanged(int idx) {
     m_ui->hostLineEdit->setVisible(isServer);
     m_ui->portLabel->setVisible(isServer);
     m_ui->portSpinBox->setVisible(isServer);
+    m_ui->timeoutLabel->setVisible(isServer);
+    m_ui->timeoutSpinBox->setVisible(isServer);
     validate();
 }
 
@@ -93,6 +106,7 @@ void AddDictDialog::validate() {
     switch (index) {
     case DictType_System:
     case DictType_User:
+    case DictType_MappedSystem:
         if (m_ui->urlLineEdit->text().isEmpty()) {
             valid = false;
         }
@@ -108,7 +122,8 @@ void AddDictDialog::validate() {
 
 void AddDictDialog::browseClicked() {
     QString path = m_ui->urlLineEdit->text();
-    if (m_ui->typeComboBox->currentIndex() == DictType_System) {
+    const auto index = m_ui->typeComboBox->currentIndex();
+    if (index == DictType_System || index == DictType_MappedSystem) {
         QString dir;
         if (path.isEmpty()) {
             path = SKK_PATH "SKK-JISYO.L";
@@ -6,6 +6,9 @@
  */
 
 #include "dictmodel.h"
+#include <filesystem>
+#include <string>
+#include <system_error>
 #include <QAbstractListModel>
 #include <QByteArray>
 #include <QDebug>
@@ -16,14 +19,47 @@
 #include <QTemporaryFile>
 #include <Qt>
 #include <QtGlobal>
+#include <fcitx-utils/i18n.h>
 #include <fcitx-utils/standardpaths.h>
+#include <fcitxqti18nhelper.h>
+#include "dictcache.h"
 
 namespace fcitx {
 
+namespace {
+
+// Returns the compiled UTF-8 copy that fcitx5-skk uses in place of the
+// dictionary file, or an empty string if there is none.
+QString cachedCopy(const QMap<QString, QString> &dict) {
+    const auto type = dict.value("type");
+    if ((type != "file" && type != "mmap") ||
+        dict.value("mode") == "readwrite") {
+        return {};
+    }
+    const auto format = type == "file" ? DictionaryCacheFormat::Cdb
+                                       : DictionaryCacheFormat::Mmap;
+    const auto path = resolveDictionaryPath(dict.value("file").toStdString());
+    if (path.ends_with(format == DictionaryCacheFormat::Cdb ? ".cdb"
+                                                            : ".skkmap")) {
+        return {};
+    }
+    const auto encoding = dict.value("encoding", "EUC-JP").toStdString();
+    const auto cachePath = dictionaryCachePath(path, encoding, format);
+    std::error_code ec;
+    if (cachePath.empty() || !std::filesystem::is_regular_file(cachePath, ec)) {
+        return {};
+    }
+    return QString::fromStdString(cachePath.string());
+}
+
+} // namespace
+
 SkkDictModel::SkkDictModel(QObject *parent) : QAbstractListModel(parent) {
     m_knownKeys << "file"
                 << "host"
                 << "port"
+                << "timeout"
+                << "group"
                 << "type"
                 << "mode"
                 << "encoding";
@@ -55,6 +91,7 @@ void SkkDictModel::load() {
 void SkkDictModel::load(QFile &file) {
     beginResetModel();
     m_dicts.clear();
+    m_cachedCopies.clear();
 
     QByteArray bytes;
     while (!(bytes = file.readLine()).isEmpty()) {
@@ -83,6 +120,7 @@ void SkkDictModel::load(QFile &file) {
         }
 
         if (!failed && 3 <= dict.size()) {
+            m_cachedCopies << cachedCopy(dict);
             m_dicts << dict;
         }
     }
@@ -135,6 +173,8 @@ bool SkkDictModel::removeRows(int row, int count, const QModelIndex &parent) {
 
     beginRemoveRows(parent, row, row + count - 1);
     m_dicts.erase(m_dicts.begin() + row, m_dicts.begin() + row + count);
+    m_cachedCopies.erase(m_cachedCopies.begin() + row,
+                         m_cachedCopies.begin() + row + count);
     endRemoveRows();
 
     return true;
@@ -151,12 +191,22 @@ QVariant SkkDictModel::data(const QModelIndex &index, int role) const {
 
     switch (role) {
     case Qt::DisplayRole:
-        if (m_dicts[index.row()]["type"] == "file") {
+        if (m_dicts[index.row()]["type"] == "file" ||
+            m_dicts[index.row()]["type"] == "mmap") {
+            if (!m_cachedCopies[index.row()].isEmpty()) {
+                return QString(_("%1 (cached)"))
+                    .arg(m_dicts[index.row()]["file"]);
+            }
             return m_dicts[index.row()]["file"];
         } else {
             return QString("%1:%2").arg(m_dicts[index.row()]["host"],
                                         m_dicts[index.row()]["port"]);
         }
+    case Qt::ToolTipRole:
+        if (const auto &path = m_cachedCopies[index.row()]; !path.isEmpty()) {
+            return QString(_("Using UTF-8 cached copy: %1")).arg(path);
+        }
+        break;
     default:
         break;
     }
@@ -167,6 +217,7 @@ bool SkkDictModel::moveUp(const QModelIndex &currentIndex) {
     if (currentIndex.row() > 0 && currentIndex.row() < m_dicts.size()) {
         beginResetModel();
         m_dicts.swapItemsAt(currentIndex.row() - 1, currentIndex.row());
+        m_cachedCopies.swapItemsAt(currentIndex.row() - 1, currentIndex.row());
         endResetModel();
         return true;
     }
@@ -177,6 +228,7 @@ bool SkkDictModel::moveDown(const QModelIndex &currentIndex) {
     if (currentIndex.row() >= 0 && currentIndex.row() + 1 < m_dicts.size()) {
         beginResetModel();
         m_dicts.swapItemsAt(currentIndex.row() + 1, currentIndex.row());
+        m_cachedCopies.swapItemsAt(currentIndex.row() + 1, currentIndex.row());
         endResetModel();
         return true;
     }
@@ -186,6 +238,7 @@ bool SkkDictModel::moveDown(const QModelIndex &currentIndex) {
 
 void SkkDictModel::add(const QMap<QString, QString> &dict) {
     beginInsertRows(QModelIndex(), m_dicts.size(), m_dicts.size());
+    m_cachedCopies << cachedCopy(dict);
     m_dicts << dict;
     endInsertRows();
 }
@@ -10,6 +10,7 @@
 #include <QAbstractItemModel>
 #include <QFile>
 #include <QSet>
+#include <QStringList>
 
 namespace fcitx {
 
@@ -34,6 +35,9 @@ public:
 private:
     QSet<QString> m_knownKeys;
     QList<QMap<QString, QString>> m_dicts;
+    // Compiled copy of each dictionary in m_dicts, looked up once when the
+    // row is added instead of on every repaint.
+    QStringList m_cachedCopies;
 };
 
 } // namespace fcitx
@@ -0,0 +1,322 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "cachedict.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <glib-object.h>
+#include <glib.h>
+#include <libskk/libskk.h>
+#include "dictutils.h"
+#include "servdict.h"
+#include "skklog.h"
+
+namespace fcitx {
+
+namespace {
+
+// Log the counters every this many lookups.
+constexpr uint64_t statisticsInterval = 1000;
+
+struct CachedCandidate {
+    std::string text;
+    std::string annotation;
+    std::string output;
+    bool hasAnnotation;
+};
+
+class LookupCache {
+public:
+    explicit LookupCache(size_t capacity) : capacity_(capacity) {}
+
+    const std::vector<CachedCandidate> *find(const std::string &key) {
+        auto iter = index_.find(key);
+        if (iter == index_.end()) {
+            return nullptr;
+        }
+        entries_.splice(entries_.begin(), entries_, iter->second);
+        return &iter->second->second;
+    }
+
+    void insert(std::string key, std::vector<CachedCandidate> candidates) {
+        if (capacity_ == 0) {
+            return;
+        }
+        erase(key);
+        entries_.emplace_front(std::move(key), std::move(candidates));
+        index_.emplace(entries_.front().first, entries_.begin());
+        while (entries_.size() > capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+    }
+
+    void erase(const std::string &key) {
+        if (auto iter = index_.find(key); iter != index_.end()) {
+            entries_.erase(iter->second);
+            index_.erase(iter);
+        }
+    }
+
+    void clear() {
+        index_.clear();
+        entries_.clear();
+    }
+
+    void setCapacity(size_t capacity) {
+        capacity_ = capacity;
+        while (entries_.size() > capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+    }
+
+    size_t size() const { return entries_.size(); }
+
+private:
+    using Entry = std::pair<std::string, std::vector<CachedCandidate>>;
+    size_t capacity_;
+    std::list<Entry> entries_;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+};
+
+struct FcitxSkkCachedDict {
+    SkkDict parent_instance;
+    std::vector<SkkDict *> *dictionaries;
+    LookupCache *cache;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct FcitxSkkCachedDictClass {
+    SkkDictClass parent_class;
+};
+
+G_DEFINE_TYPE(FcitxSkkCachedDict, fcitx_skk_cached_dict, SKK_TYPE_DICT)
+
+FcitxSkkCachedDict *toCachedDict(SkkDict *dict) {
+    return reinterpret_cast<FcitxSkkCachedDict *>(dict);
+}
+
+std::string cacheKey(const gchar *midasi, bool okuri) {
+    std::string key = midasi;
+    key.push_back(okuri ? '\1' : '\0');
+    return key;
+}
+
+void logStatistics(FcitxSkkCachedDict *self) {
+    SKK_DEBUG() << "Lookup cache hits: " << self->hits
+                << " misses: " << self->misses
+                << " size: " << self->cache->size();
+}
+
+void invalidate(FcitxSkkCachedDict *self, SkkCandidate *candidate) {
+    const auto *midasi = skk_candidate_get_midasi(candidate);
+    self->cache->erase(cacheKey(midasi, true));
+    self->cache->erase(cacheKey(midasi, false));
+}
+
+void fcitx_skk_cached_dict_finalize(GObject *object) {
+    auto *self = reinterpret_cast<FcitxSkkCachedDict *>(object);
+    logStatistics(self);
+    for (auto *dict : *self->dictionaries) {
+        g_object_unref(dict);
+    }
+    delete self->dictionaries;
+    delete self->cache;
+    G_OBJECT_CLASS(fcitx_skk_cached_dict_parent_class)->finalize(object);
+}
+
+void fcitx_skk_cached_dict_reload(SkkDict *dict, GError **error) {
+    auto *self = toCachedDict(dict);
+    self->cache->clear();
+    for (auto *subDict : *self->dictionaries) {
+        skk_dict_reload(subDict, error);
+        if (error && *error) {
+            return;
+        }
+    }
+}
+
+SkkCandidate **fcitx_skk_cached_dict_lookup(SkkDict *dict, const gchar *midasi,
+                                            gboolean okuri, gint *length) {
+    auto *self = toCachedDict(dict);
+    if ((self->hits + self->misses + 1) % statisticsInterval == 0) {
+        logStatistics(self);
+    }
+
+    auto key = cacheKey(midasi, okuri);
+    std::vector<SkkCandidate *> candidates;
+    if (const auto *cached = self->cache->find(key)) {
+        self->hits += 1;
+        for (const auto &candidate : *cached) {
+            candidates.push_back(skk_candidate_new(
+                midasi, okuri, candidate.text.data(),
+                candidate.hasAnnotation ? candidate.annotation.data()
+                                        : nullptr,
+                candidate.output.data()));
+        }
+        return newCandidateArray(candidates, length);
+    }
+
+    self->misses += 1;
+    std::vector<CachedCandidate> cached;
+    std::unordered_set<std::string> seen;
+    bool complete = true;
+    for (auto *subDict : *self->dictionaries) {
+        gint subLength = 0;
+        SkkCandidate **subCandidates =
+            skk_dict_lookup(subDict, midasi, okuri, &subLength);
+        // Late server answer is returned by the next lookup, which should
+        // not be shadowed by this partial result.
+        if (isServerDictLookupPending(subDict)) {
+            complete = false;
+        }
+        for (gint i = 0; i < subLength; i++) {
+            SkkCandidate *candidate = subCandidates[i];
+            const auto *text = skk_candidate_get_text(candidate);
+            if (!seen.insert(text).second) {
+                g_object_unref(candidate);
+                continue;
+            }
+            const auto *annotation = skk_candidate_get_annotation(candidate);
+            const auto *output = skk_candidate_get_output(candidate);
+            cached.push_back({text, annotation ? annotation : "",
+                              output ? output : text, annotation != nullptr});
+            candidates.push_back(candidate);
+        }
+        g_free(subCandidates);
+    }
+    if (complete) {
+        self->cache->insert(std::move(key), std::move(cached));
+    }
+    return newCandidateArray(candidates, length);
+}
+
+gchar **fcitx_skk_cached_dict_complete(SkkDict *dict, const gchar *midasi,
+                                       gint *length) {
+    auto *self = toCachedDict(dict);
+    std::vector<std::string> completions;
+    std::unordered_set<std::string> seen;
+    for (auto *subDict : *self->dictionaries) {
+        gint subLength = 0;
+        gchar **subCompletions =
+            skk_dict_complete(subDict, midasi, &subLength);
+        for (gint i = 0; i < subLength; i++) {
+            if (seen.insert(subCompletions[i]).second) {
+                completions.push_back(subCompletions[i]);
+            }
+        }
+        g_strfreev(subCompletions);
+    }
+    return newStringArray(completions, length);
+}
+
+gboolean fcitx_skk_cached_dict_select_candidate(SkkDict *dict,
+                                                SkkCandidate *candidate) {
+    auto *self = toCachedDict(dict);
+    invalidate(self, candidate);
+    gboolean result = FALSE;
+    for (auto *subDict : *self->dictionaries) {
+        if (!skk_dict_get_read_only(subDict) &&
+            skk_dict_select_candidate(subDict, candidate)) {
+            result = TRUE;
+        }
+    }
+    return result;
+}
+
+gboolean fcitx_skk_cached_dict_purge_candidate(SkkDict *dict,
+                                               SkkCandidate *candidate) {
+    auto *self = toCachedDict(dict);
+    invalidate(self, candidate);
+    gboolean result = FALSE;
+    for (auto *subDict : *self->dictionaries) {
+        if (!skk_dict_get_read_only(subDict) &&
+            skk_dict_purge_candidate(subDict, candidate)) {
+            result = TRUE;
+        }
+    }
+    return result;
+}
+
+void fcitx_skk_cached_dict_save(SkkDict *dict, GError **error) {
+    auto *self = toCachedDict(dict);
+    for (auto *subDict : *self->dictionaries) {
+        if (skk_dict_get_read_only(subDict)) {
+            continue;
+        }
+        skk_dict_save(subDict, error);
+        if (error && *error) {
+            return;
+        }
+    }
+}
+
+gboolean fcitx_skk_cached_dict_get_read_only(SkkDict *dict) {
+    auto *self = toCachedDict(dict);
+    for (auto *subDict : *self->dictionaries) {
+        if (!skk_dict_get_read_only(subDict)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void fcitx_skk_cached_dict_init(FcitxSkkCachedDict * /*self*/) {}
+
+void fcitx_skk_cached_dict_class_init(FcitxSkkCachedDictClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = fcitx_skk_cached_dict_finalize;
+    auto *dictClass = SKK_DICT_CLASS(klass);
+    dictClass->reload = fcitx_skk_cached_dict_reload;
+    dictClass->lookup = fcitx_skk_cached_dict_lookup;
+    dictClass->complete = fcitx_skk_cached_dict_complete;
+    dictClass->select_candidate = fcitx_skk_cached_dict_select_candidate;
+    dictClass->purge_candidate = fcitx_skk_cached_dict_purge_candidate;
+    dictClass->save = fcitx_skk_cached_dict_save;
+    dictClass->get_read_only = fcitx_skk_cached_dict_get_read_only;
+}
+
+} // namespace
+
+SkkDict *newCachedDict(const std::vector<SkkDict *> &dictionaries,
+                       size_t capacity) {
+    auto *self = static_cast<FcitxSkkCachedDict *>(
+        g_object_new(fcitx_skk_cached_dict_get_type(), nullptr));
+    self->dictionaries = new std::vector<SkkDict *>();
+    for (auto *dict : dictionaries) {
+        self->dictionaries->push_back(SKK_DICT(g_object_ref(dict)));
+    }
+    self->cache = new LookupCache(capacity);
+    return SKK_DICT(self);
+}
+
+void updateCachedDict(SkkDict *dict,
+                      const std::vector<SkkDict *> &dictionaries,
+                      size_t capacity) {
+    auto *self = toCachedDict(dict);
+    self->cache->setCapacity(capacity);
+    if (*self->dictionaries == dictionaries) {
+        return;
+    }
+    self->cache->clear();
+    for (auto *subDict : dictionaries) {
+        g_object_ref(subDict);
+    }
+    for (auto *subDict : *self->dictionaries) {
+        g_object_unref(subDict);
+    }
+    *self->dictionaries = dictionaries;
+}
+
+} // namespace fcitx
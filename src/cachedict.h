@@ -0,0 +1,32 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_CACHEDICT_H_
+#define _FCITX_SKK_CACHEDICT_H_
+
+#include <cstddef>
+#include <vector>
+#include <libskk/libskk.h>
+
+namespace fcitx {
+
+// Create a dictionary that looks up the given dictionaries in order, and
+// remembers the merged result of the most recent capacity lookups. Learning
+// a candidate goes to every writable dictionary and invalidates the cached
+// result of its midasi. The returned object is only meant to be used from
+// the main thread.
+SkkDict *newCachedDict(const std::vector<SkkDict *> &dictionaries,
+                       size_t capacity);
+
+// Change what a dictionary created by newCachedDict looks up. The cached
+// results are only dropped if the dictionaries or their order change.
+void updateCachedDict(SkkDict *dict,
+                      const std::vector<SkkDict *> &dictionaries,
+                      size_t capacity);
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_CACHEDICT_H_
@@ -0,0 +1,357 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "dictcache.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/charutils.h>
+#include <fcitx-utils/fs.h>
+#include <fcitx-utils/standardpaths.h>
+#include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/unixfd.h>
+#include <glib.h>
+#include "dictutils.h"
+
+namespace fcitx {
+
+namespace {
+
+constexpr uint32_t cdbHeaderSize = 256 * 8;
+
+uint32_t cdbHash(std::string_view key) {
+    uint32_t h = 5381;
+    for (unsigned char c : key) {
+        h = ((h << 5) + h) ^ c;
+    }
+    return h;
+}
+
+uint64_t fnv1a(std::string_view data) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void appendUInt32(std::string &out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+// Prefix shared by all cache files of the same source and encoding, they
+// only differ in the modification time and size of the source.
+std::string cachePrefix(const std::string &source,
+                        const std::string &encoding) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx",
+             static_cast<unsigned long long>(fnv1a(source)));
+    std::string safeEncoding;
+    for (char c : encoding) {
+        safeEncoding.push_back(
+            (charutils::isupper(c) || charutils::islower(c) ||
+             charutils::isdigit(c))
+                ? c
+                : '_');
+    }
+    return stringutils::concat(buf, "-", safeEncoding, "-");
+}
+
+// Caches of the same source in another encoding are kept, dictionary_list may
+// use both.
+void removeStaleCaches(const std::filesystem::path &keep,
+                       const std::string &prefix) {
+    std::error_code ec;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(keep.parent_path(), ec)) {
+        const auto name = entry.path().filename().string();
+        if (entry.path() != keep && name.starts_with(prefix) &&
+            entry.path().extension() == keep.extension()) {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+}
+
+bool isUtf8(const std::string &encoding) {
+    return g_ascii_strcasecmp(encoding.data(), "UTF-8") == 0 ||
+           g_ascii_strcasecmp(encoding.data(), "UTF8") == 0;
+}
+
+// Convert content to UTF-8. A line that can not be converted is dropped
+// instead of failing the whole dictionary.
+bool transcodeToUtf8(std::string &content, const std::string &encoding) {
+    if (isUtf8(encoding)) {
+        return true;
+    }
+    if (auto converted = convertEncoding(content, "UTF-8", encoding.data())) {
+        content = std::move(*converted);
+        return true;
+    }
+
+    std::string result;
+    result.reserve(content.size() + content.size() / 2);
+    std::string_view rest = content;
+    while (!rest.empty()) {
+        auto end = rest.find('\n');
+        auto line =
+            rest.substr(0, end == std::string_view::npos ? end : end + 1);
+        rest.remove_prefix(line.size());
+        if (auto converted =
+                convertEncoding(line, "UTF-8", encoding.data())) {
+            result.append(*converted);
+        }
+    }
+    if (result.empty()) {
+        return false;
+    }
+    content = std::move(result);
+    return true;
+}
+
+// The cache is trusted until the source changes, so it is synced before it
+// is renamed in place, a crash must not leave a truncated cache behind.
+bool writeFile(const std::filesystem::path &output, std::string_view data) {
+    UnixFD fd = UnixFD::own(::open(output.c_str(),
+                                   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                   0644));
+    if (!fd.isValid()) {
+        return false;
+    }
+    return fs::safeWrite(fd.fd(), data.data(), data.size()) ==
+               static_cast<ssize_t>(data.size()) &&
+           ::fsync(fd.fd()) == 0;
+}
+
+} // namespace
+
+std::string resolveDictionaryPath(const std::string &path) {
+    std::string_view partialpath = path;
+    if (stringutils::consumePrefix(partialpath, "$FCITX_CONFIG_DIR/")) {
+        return StandardPaths::global().userDirectory(
+                   StandardPathsType::PkgData) /
+               partialpath;
+    }
+    if (stringutils::consumePrefix(partialpath, "$XDG_DATA_DIRS/")) {
+        return StandardPaths::global().locate(StandardPathsType::Data,
+                                              partialpath);
+    }
+    return path;
+}
+
+bool readDictionaryFile(const std::string &source, const std::string &encoding,
+                        std::string &content) {
+    std::ifstream in(source, std::ios::in | std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    content.assign(std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>());
+    return !in.bad() && transcodeToUtf8(content, encoding);
+}
+
+std::filesystem::path dictionaryCacheDirectory() {
+    return StandardPaths::global().userDirectory(StandardPathsType::PkgData) /
+           "skk/cache";
+}
+
+std::filesystem::path dictionaryCachePath(const std::string &source,
+                                          const std::string &encoding,
+                                          DictionaryCacheFormat format) {
+    struct stat st;
+    if (source.empty() || stat(source.data(), &st) != 0) {
+        return {};
+    }
+
+    // The encoding is the one of the source, the cache itself is UTF-8. The
+    // number in the mmap suffix is bumped when what is compiled changes, so
+    // caches of an older version are rebuilt.
+    return dictionaryCacheDirectory() /
+           stringutils::concat(
+               cachePrefix(source, encoding), st.st_mtim.tv_sec, ".",
+               st.st_mtim.tv_nsec, "-", st.st_size,
+               format == DictionaryCacheFormat::Cdb ? ".utf8.cdb"
+                                                    : ".utf8.2.skkmap");
+}
+
+std::filesystem::path compiledDictionary(const std::string &source,
+                                         const std::string &encoding,
+                                         DictionaryCacheFormat format) {
+    auto path = dictionaryCachePath(source, encoding, format);
+    if (path.empty()) {
+        return {};
+    }
+
+    std::error_code ec;
+    if (std::filesystem::is_regular_file(path, ec)) {
+        return path;
+    }
+
+    if (!fs::makePath(path.parent_path())) {
+        return {};
+    }
+
+    // Multiple fcitx instance or loader threads may compile the same file,
+    // so write to a private file and rename it in place.
+    static std::atomic<unsigned int> tempId = 0;
+    auto tempPath = path;
+    tempPath += stringutils::concat(".", getpid(), ".", tempId++, ".tmp");
+    const bool success = format == DictionaryCacheFormat::Cdb
+                             ? compileDictionaryToCdb(source, encoding,
+                                                      tempPath)
+                             : compileDictionaryToMmap(source, encoding,
+                                                       tempPath);
+    if (!success) {
+        std::filesystem::remove(tempPath, ec);
+        return {};
+    }
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tempPath, ec);
+        return {};
+    }
+    removeStaleCaches(path, cachePrefix(source, encoding));
+    return path;
+}
+
+bool compileDictionaryToCdb(const std::string &source,
+                            const std::string &encoding,
+                            const std::filesystem::path &output) {
+    std::string content;
+    if (!readDictionaryFile(source, encoding, content)) {
+        return false;
+    }
+
+    struct Slot {
+        uint32_t hash = 0;
+        uint32_t pos = 0;
+    };
+    std::array<std::vector<Slot>, 256> tables;
+    // Header is filled in once all records are known.
+    std::string data(cdbHeaderSize, '\0');
+
+    bool overflow = false;
+    forEachDictionaryEntry(content, [&](std::string_view, std::string_view key,
+                                        std::string_view value,
+                                        std::optional<bool>) {
+        if (data.size() + 8 + key.size() + value.size() >
+            std::numeric_limits<uint32_t>::max()) {
+            overflow = true;
+            return;
+        }
+        const auto hash = cdbHash(key);
+        tables[hash & 0xff].push_back(
+            {hash, static_cast<uint32_t>(data.size())});
+        appendUInt32(data, key.size());
+        appendUInt32(data, value.size());
+        data.append(key);
+        data.append(value);
+    });
+    if (overflow) {
+        return false;
+    }
+
+    std::string header;
+    for (const auto &table : tables) {
+        const uint32_t length = table.size() * 2;
+        std::vector<Slot> slots(length);
+        for (const auto &slot : table) {
+            auto index = (slot.hash >> 8) % length;
+            while (slots[index].pos != 0) {
+                index = (index + 1) % length;
+            }
+            slots[index] = slot;
+        }
+        if (data.size() + (length * 8) > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+        appendUInt32(header, data.size());
+        appendUInt32(header, length);
+        for (const auto &slot : slots) {
+            appendUInt32(data, slot.hash);
+            appendUInt32(data, slot.pos);
+        }
+    }
+    data.replace(0, cdbHeaderSize, header);
+
+    return writeFile(output, data);
+}
+
+bool compileDictionaryToMmap(const std::string &source,
+                             const std::string &encoding,
+                             const std::filesystem::path &output) {
+    std::string content;
+    if (!readDictionaryFile(source, encoding, content)) {
+        return false;
+    }
+
+    std::vector<std::pair<std::string_view, std::string_view>> okuriAri;
+    std::vector<std::pair<std::string_view, std::string_view>> okuriNasi;
+    forEachDictionaryEntry(content, [&](std::string_view line,
+                                        std::string_view midasi,
+                                        std::string_view,
+                                        std::optional<bool> okuri) {
+        (okuri.value_or(isOkuriAri(midasi)) ? okuriAri : okuriNasi)
+            .emplace_back(midasi, line);
+    });
+    // Keep the first one if there is any duplicate, same as the file dict.
+    for (auto *entries : {&okuriAri, &okuriNasi}) {
+        std::stable_sort(entries->begin(), entries->end(),
+                         [](const auto &lhs, const auto &rhs) {
+                             return lhs.first < rhs.first;
+                         });
+        entries->erase(std::unique(entries->begin(), entries->end(),
+                                   [](const auto &lhs, const auto &rhs) {
+                                       return lhs.first == rhs.first;
+                                   }),
+                       entries->end());
+    }
+
+    const size_t indexSize =
+        (okuriAri.size() + okuriNasi.size()) * sizeof(uint32_t);
+    std::string header(mmapDictionaryMagic);
+    appendUInt32(header, okuriAri.size());
+    appendUInt32(header, okuriNasi.size());
+
+    std::string index;
+    index.reserve(indexSize);
+    std::string text;
+    text.reserve(content.size());
+    for (const auto *entries : {&okuriAri, &okuriNasi}) {
+        for (const auto &[midasi, line] : *entries) {
+            const size_t offset = header.size() + indexSize + text.size();
+            if (offset + line.size() + 1 >
+                std::numeric_limits<uint32_t>::max()) {
+                return false;
+            }
+            appendUInt32(index, offset);
+            text.append(line);
+            text.push_back('\n');
+        }
+    }
+
+    return writeFile(output, stringutils::concat(header, index, text));
+}
+
+} // namespace fcitx
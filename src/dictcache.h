@@ -0,0 +1,126 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_DICTCACHE_H_
+#define _FCITX_SKK_DICTCACHE_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <fcitx-utils/charutils.h>
+
+namespace fcitx {
+
+enum class DictionaryCacheFormat { Cdb, Mmap };
+
+// Layout of the file read by FcitxSkkMmapDict, all integers are little endian:
+//   magic
+//   uint32 number of okuri-ari entries
+//   uint32 number of okuri-nasi entries
+//   uint32 offsets of okuri-ari lines, sorted by midasi
+//   uint32 offsets of okuri-nasi lines, sorted by midasi
+//   lines in the form of "midasi /candidate/.../\n"
+constexpr std::string_view mmapDictionaryMagic = "FSKKMAP1";
+constexpr uint32_t mmapDictionaryHeaderSize = mmapDictionaryMagic.size() + 8;
+
+// Comments that start the sections of a SKK-JISYO style dictionary.
+constexpr std::string_view okuriAriMarker = ";; okuri-ari entries.";
+constexpr std::string_view okuriNasiMarker = ";; okuri-nasi entries.";
+
+// Calls callback(line, midasi, candidates, okuri) for every entry of a
+// SKK-JISYO style dictionary, where line does not include the line break.
+// okuri tells the section the entry is in, and is empty before the first
+// section marker.
+template <typename Callback>
+void forEachDictionaryEntry(std::string_view content, Callback callback) {
+    std::optional<bool> okuri;
+    while (!content.empty()) {
+        auto end = content.find('\n');
+        auto line = content.substr(0, end);
+        content.remove_prefix(end == std::string_view::npos ? content.size()
+                                                            : end + 1);
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+        if (line.starts_with(okuriAriMarker)) {
+            okuri = true;
+            continue;
+        }
+        if (line.starts_with(okuriNasiMarker)) {
+            okuri = false;
+            continue;
+        }
+        if (line.empty() || line.front() == ';') {
+            continue;
+        }
+        auto space = line.find(' ');
+        if (space == std::string_view::npos || space == 0) {
+            continue;
+        }
+        auto midasi = line.substr(0, space);
+        auto candidates = line.substr(space + 1);
+        if (!candidates.starts_with('/')) {
+            continue;
+        }
+        callback(line, midasi, candidates, okuri);
+    }
+}
+
+// Okuri-ari midasi is reading followed by a latin letter, e.g. "あr". Only
+// used for entries outside of a section, e.g. in a file without markers,
+// since an abbrev reading may look the same.
+inline bool isOkuriAri(std::string_view midasi) {
+    return midasi.size() > 1 && static_cast<unsigned char>(midasi[0]) >= 0x80 &&
+           charutils::islower(midasi.back());
+}
+
+// Read a text dictionary and convert it from encoding to UTF-8.
+bool readDictionaryFile(const std::string &source, const std::string &encoding,
+                        std::string &content);
+
+// Expand $FCITX_CONFIG_DIR/ and $XDG_DATA_DIRS/ in the file= value of
+// dictionary_list.
+std::string resolveDictionaryPath(const std::string &path);
+
+// Directory that holds dictionaries compiled by fcitx5-skk,
+// $FCITX_CONFIG_DIR/skk/cache.
+std::filesystem::path dictionaryCacheDirectory();
+
+// Path of the file compiled from a text dictionary. The name depends on the
+// source path, its modification time and the encoding, so a modified source
+// never matches an old cache. Returns an empty path if the source can not be
+// accessed.
+//
+// Compiled dictionaries are always UTF-8 regardless of the encoding of the
+// source, so they can be looked up without charset conversion.
+std::filesystem::path dictionaryCachePath(const std::string &source,
+                                          const std::string &encoding,
+                                          DictionaryCacheFormat format);
+
+// Returns the compiled cache of source, building it if it does not exist yet.
+// Returns an empty path on failure, in which case the source should be used
+// directly.
+std::filesystem::path compiledDictionary(const std::string &source,
+                                         const std::string &encoding,
+                                         DictionaryCacheFormat format);
+
+// Convert a SKK-JISYO style text dictionary in encoding to the cdb format
+// read by SkkCdbDict, in UTF-8.
+bool compileDictionaryToCdb(const std::string &source,
+                            const std::string &encoding,
+                            const std::filesystem::path &output);
+
+// Convert a SKK-JISYO style text dictionary in encoding to the format read
+// by FcitxSkkMmapDict, in UTF-8.
+bool compileDictionaryToMmap(const std::string &source,
+                             const std::string &encoding,
+                             const std::filesystem::path &output);
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_DICTCACHE_H_
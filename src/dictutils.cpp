@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "dictutils.h"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/misc.h>
+#include <glib-object.h>
+#include <glib.h>
+#include <libskk/libskk.h>
+
+namespace fcitx {
+
+std::vector<std::pair<std::string_view, std::string_view>>
+splitCandidates(std::string_view line) {
+    std::vector<std::pair<std::string_view, std::string_view>> result;
+    bool inOkuriBlock = false;
+    while (!line.empty()) {
+        auto end = line.find('/');
+        auto item = line.substr(0, end);
+        line.remove_prefix(end == std::string_view::npos ? line.size()
+                                                         : end + 1);
+        if (inOkuriBlock) {
+            inOkuriBlock = item != "]";
+            continue;
+        }
+        if (item.starts_with('[')) {
+            inOkuriBlock = true;
+            continue;
+        }
+        if (item.empty()) {
+            continue;
+        }
+        std::string_view annotation;
+        if (auto semicolon = item.find(';');
+            semicolon != std::string_view::npos) {
+            annotation = item.substr(semicolon + 1);
+            item = item.substr(0, semicolon);
+        }
+        result.emplace_back(item, annotation);
+    }
+    return result;
+}
+
+SkkCandidate **newCandidateArray(const char *midasi, bool okuri,
+                                 std::string_view line, gint *length) {
+    std::vector<SkkCandidate *> candidates;
+    for (const auto &[text, annotation] : splitCandidates(line)) {
+        std::string textString(text);
+        std::string annotationString(annotation);
+        candidates.push_back(skk_candidate_new(
+            midasi, okuri, textString.data(),
+            annotation.empty() ? nullptr : annotationString.data(),
+            textString.data()));
+    }
+    return newCandidateArray(candidates, length);
+}
+
+SkkCandidate **newCandidateArray(const std::vector<SkkCandidate *> &candidates,
+                                 gint *length) {
+    auto **result = g_new0(SkkCandidate *, candidates.size() + 1);
+    for (size_t i = 0; i < candidates.size(); i++) {
+        result[i] = candidates[i];
+    }
+    if (length) {
+        *length = candidates.size();
+    }
+    return result;
+}
+
+gchar **newStringArray(const std::vector<std::string> &strings, gint *length) {
+    auto **result = g_new0(gchar *, strings.size() + 1);
+    for (size_t i = 0; i < strings.size(); i++) {
+        result[i] = g_strndup(strings[i].data(), strings[i].size());
+    }
+    if (length) {
+        *length = strings.size();
+    }
+    return result;
+}
+
+std::optional<std::string> convertEncoding(std::string_view text,
+                                           const char *to, const char *from) {
+    if (g_ascii_strcasecmp(to, from) == 0) {
+        return std::string(text);
+    }
+    gsize written = 0;
+    UniqueCPtr<gchar, g_free> converted{g_convert(
+        text.data(), text.size(), to, from, nullptr, &written, nullptr)};
+    if (!converted) {
+        return std::nullopt;
+    }
+    return std::string(converted.get(), written);
+}
+
+} // namespace fcitx
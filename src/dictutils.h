@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_DICTUTILS_H_
+#define _FCITX_SKK_DICTUTILS_H_
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <glib.h>
+#include <libskk/libskk.h>
+
+namespace fcitx {
+
+// Split the candidate part of a dictionary line, e.g. "/text;annotation/",
+// into pairs of text and annotation. Okuri blocks like "[る/.../]" are
+// skipped.
+std::vector<std::pair<std::string_view, std::string_view>>
+splitCandidates(std::string_view line);
+
+// Helpers to build the arrays returned by SkkDict::lookup and
+// SkkDict::complete, they follow the vala array convention.
+SkkCandidate **newCandidateArray(const char *midasi, bool okuri,
+                                 std::string_view line, gint *length);
+SkkCandidate **newCandidateArray(const std::vector<SkkCandidate *> &candidates,
+                                 gint *length);
+gchar **newStringArray(const std::vector<std::string> &strings, gint *length);
+
+// Convert text between dictionary encoding and UTF-8.
+std::optional<std::string> convertEncoding(std::string_view text,
+                                           const char *to, const char *from);
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_DICTUTILS_H_
@@ -0,0 +1,157 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "dictwatcher.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/unixfd.h>
+#include "skklog.h"
+
+namespace fcitx {
+
+namespace {
+
+// A file is usually written in several steps, or several files are updated
+// at once. Wait until it settles down before reloading.
+constexpr uint64_t reloadDelay = 500000;
+
+constexpr uint32_t watchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                               IN_CREATE | IN_DELETE | IN_ATTRIB |
+                               IN_ONLYDIR;
+
+} // namespace
+
+DictionaryWatcher::DictionaryWatcher(EventLoop *loop,
+                                     std::function<void()> callback)
+    : loop_(loop), callback_(std::move(callback)),
+      fd_(UnixFD::own(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))) {
+    if (!fd_.isValid()) {
+        SKK_DEBUG() << "Failed to create inotify instance, errno: " << errno;
+        return;
+    }
+    ioEvent_ = loop_->addIOEvent(
+        fd_.fd(), IOEventFlag::In,
+        [this](EventSourceIO *, int, IOEventFlags) { return handleEvents(); });
+}
+
+DictionaryWatcher::~DictionaryWatcher() = default;
+
+void DictionaryWatcher::setFiles(const std::vector<std::string> &files) {
+    if (!fd_.isValid()) {
+        return;
+    }
+
+    // Adding a directory that is already watched returns the same watch
+    // descriptor, so only the directories no longer used need to be removed.
+    std::unordered_map<int, std::unordered_set<std::string>> watches;
+    for (const auto &file : files) {
+        const std::filesystem::path path(file);
+        if (!path.has_parent_path() || !path.has_filename()) {
+            continue;
+        }
+        // If the directory does not exist yet, watch the nearest one that
+        // does for the next directory on the way to the file. Once that is
+        // created, the callback reloads and the watches are set again.
+        auto directory = path.parent_path();
+        auto name = path.filename();
+        std::error_code ec;
+        while (!std::filesystem::is_directory(directory, ec) &&
+               directory.has_relative_path()) {
+            name = directory.filename();
+            directory = directory.parent_path();
+        }
+        const int wd =
+            inotify_add_watch(fd_.fd(), directory.c_str(), watchMask);
+        if (wd < 0) {
+            SKK_DEBUG() << "Failed to watch " << directory
+                        << ", errno: " << errno;
+            continue;
+        }
+        watches[wd].insert(name.string());
+    }
+    for (const auto &[wd, _] : watches_) {
+        if (!watches.contains(wd)) {
+            inotify_rm_watch(fd_.fd(), wd);
+        }
+    }
+    watches_ = std::move(watches);
+    files_ = files;
+}
+
+bool DictionaryWatcher::handleEvents() {
+    alignas(struct inotify_event) char buffer[4096];
+    bool changed = false;
+    bool removed = false;
+    while (true) {
+        const auto length = read(fd_.fd(), buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            break;
+        }
+        for (const char *ptr = buffer; ptr < buffer + length;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                changed = true;
+                continue;
+            }
+            auto iter = watches_.find(event->wd);
+            if (iter == watches_.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The directory is gone, and so are the files in it.
+                watches_.erase(iter);
+                changed = true;
+                removed = true;
+            } else if (event->len && iter->second.contains(event->name)) {
+                SKK_DEBUG() << "Dictionary file changed: " << event->name;
+                changed = true;
+            }
+        }
+    }
+    if (removed) {
+        // Watch the nearest existing parent instead, so the directory is
+        // noticed when it is created again.
+        const auto files = files_;
+        setFiles(files);
+    }
+    if (changed) {
+        scheduleCallback();
+    }
+    return true;
+}
+
+void DictionaryWatcher::scheduleCallback() {
+    const auto time = now(CLOCK_MONOTONIC) + reloadDelay;
+    if (timer_) {
+        timer_->setTime(time);
+        timer_->setOneShot();
+        return;
+    }
+    timer_ = loop_->addTimeEvent(CLOCK_MONOTONIC, time, 0,
+                                 [this](EventSourceTime *, uint64_t) {
+                                     callback_();
+                                     return true;
+                                 });
+}
+
+} // namespace fcitx
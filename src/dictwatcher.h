@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_DICTWATCHER_H_
+#define _FCITX_SKK_DICTWATCHER_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/unixfd.h>
+
+namespace fcitx {
+
+// Watches a set of files with inotify on the fcitx event loop, and calls
+// the callback once they stop changing for a short while.
+//
+// The parent directories are watched instead of the files themselves, so
+// a file replaced by rename, as most editors and config management tools
+// do, is still noticed. A file in a directory that does not exist yet is
+// noticed as well, through the nearest existing parent. When a watched
+// directory is removed, the files are watched again at once, so this does not
+// depend on the callback calling setFiles().
+class DictionaryWatcher {
+public:
+    DictionaryWatcher(EventLoop *loop, std::function<void()> callback);
+    ~DictionaryWatcher();
+
+    bool isValid() const { return fd_.isValid(); }
+    // Replace the watched files.
+    void setFiles(const std::vector<std::string> &files);
+
+private:
+    bool handleEvents();
+    void scheduleCallback();
+
+    EventLoop *loop_;
+    std::function<void()> callback_;
+    UnixFD fd_;
+    std::unique_ptr<EventSourceIO> ioEvent_;
+    std::unique_ptr<EventSourceTime> timer_;
+    std::vector<std::string> files_;
+    // Watch descriptor to the watched file names in that directory.
+    std::unordered_map<int, std::unordered_set<std::string>> watches_;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_DICTWATCHER_H_
@@ -0,0 +1,236 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "mmapdict.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/unixfd.h>
+#include <glib-object.h>
+#include <glib.h>
+#include <libskk/libskk.h>
+#include "dictcache.h"
+#include "dictutils.h"
+
+namespace fcitx {
+
+MmapDictionary::~MmapDictionary() {
+    if (data_) {
+        munmap(const_cast<char *>(data_), size_);
+    }
+}
+
+bool MmapDictionary::open(const std::string &path) {
+    auto fd = UnixFD::own(::open(path.data(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (!fd.isValid() || fstat(fd.fd(), &st) != 0 ||
+        static_cast<size_t>(st.st_size) < mmapDictionaryHeaderSize) {
+        return false;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd.fd(), 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    data_ = static_cast<const char *>(data);
+    size_ = st.st_size;
+
+    if (std::string_view(data_, mmapDictionaryMagic.size()) !=
+        mmapDictionaryMagic) {
+        return false;
+    }
+    okuriAriCount_ = readUInt32(mmapDictionaryMagic.size());
+    okuriNasiCount_ = readUInt32(mmapDictionaryMagic.size() + 4);
+    okuriAriIndex_ = mmapDictionaryHeaderSize;
+    okuriNasiIndex_ = okuriAriIndex_ + static_cast<size_t>(okuriAriCount_) * 4;
+    return okuriNasiIndex_ + static_cast<size_t>(okuriNasiCount_) * 4 <= size_;
+}
+
+std::string_view MmapDictionary::lookup(std::string_view midasi,
+                                        bool okuri) const {
+    const auto index = okuri ? okuriAriIndex_ : okuriNasiIndex_;
+    const auto count = okuri ? okuriAriCount_ : okuriNasiCount_;
+    const auto pos = lowerBound(index, count, midasi);
+    if (pos >= count) {
+        return {};
+    }
+    auto line = lineAt(index, pos);
+    if (midasiOf(line) != midasi) {
+        return {};
+    }
+    return line.substr(midasi.size() + 1);
+}
+
+std::vector<std::string_view>
+MmapDictionary::complete(std::string_view prefix) const {
+    std::vector<std::string_view> result;
+    for (const auto &[midasi, _] : entries(prefix, okuriNasiCount_)) {
+        result.push_back(midasi);
+    }
+    return result;
+}
+
+std::vector<std::pair<std::string_view, std::string_view>>
+MmapDictionary::entries(std::string_view prefix, size_t limit) const {
+    std::vector<std::pair<std::string_view, std::string_view>> result;
+    for (auto pos = lowerBound(okuriNasiIndex_, okuriNasiCount_, prefix);
+         pos < okuriNasiCount_ && result.size() < limit; pos++) {
+        auto line = lineAt(okuriNasiIndex_, pos);
+        auto midasi = midasiOf(line);
+        if (!midasi.starts_with(prefix)) {
+            break;
+        }
+        if (midasi.size() != prefix.size()) {
+            result.emplace_back(midasi, line.substr(midasi.size() + 1));
+        }
+    }
+    return result;
+}
+
+uint32_t MmapDictionary::readUInt32(size_t offset) const {
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data_);
+    return bytes[offset] | (bytes[offset + 1] << 8) |
+           (bytes[offset + 2] << 16) |
+           (static_cast<uint32_t>(bytes[offset + 3]) << 24);
+}
+
+std::string_view MmapDictionary::lineAt(size_t index, uint32_t pos) const {
+    const size_t offset = readUInt32(index + static_cast<size_t>(pos) * 4);
+    if (offset >= size_) {
+        return {};
+    }
+    const auto *start = data_ + offset;
+    const auto *end =
+        static_cast<const char *>(memchr(start, '\n', size_ - offset));
+    return {start,
+            end ? static_cast<size_t>(end - start) : size_ - offset};
+}
+
+std::string_view MmapDictionary::midasiOf(std::string_view line) {
+    return line.substr(0, line.find(' '));
+}
+
+uint32_t MmapDictionary::lowerBound(size_t index, uint32_t count,
+                                    std::string_view midasi) const {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        const uint32_t mid = low + ((high - low) / 2);
+        if (midasiOf(lineAt(index, mid)) < midasi) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+namespace {
+
+struct FcitxSkkMmapDict {
+    SkkDict parent_instance;
+    MmapDictionary *dictionary;
+    gchar *path;
+    gchar *encoding;
+};
+
+struct FcitxSkkMmapDictClass {
+    SkkDictClass parent_class;
+};
+
+G_DEFINE_TYPE(FcitxSkkMmapDict, fcitx_skk_mmap_dict, SKK_TYPE_DICT)
+
+FcitxSkkMmapDict *toMmapDict(SkkDict *dict) {
+    return reinterpret_cast<FcitxSkkMmapDict *>(dict);
+}
+
+void fcitx_skk_mmap_dict_finalize(GObject *object) {
+    auto *self = reinterpret_cast<FcitxSkkMmapDict *>(object);
+    delete self->dictionary;
+    g_free(self->path);
+    g_free(self->encoding);
+    G_OBJECT_CLASS(fcitx_skk_mmap_dict_parent_class)->finalize(object);
+}
+
+void fcitx_skk_mmap_dict_reload(SkkDict *dict, GError ** /*error*/) {
+    auto *self = toMmapDict(dict);
+    auto dictionary = std::make_unique<MmapDictionary>();
+    if (dictionary->open(self->path)) {
+        delete self->dictionary;
+        self->dictionary = dictionary.release();
+    }
+}
+
+SkkCandidate **fcitx_skk_mmap_dict_lookup(SkkDict *dict, const gchar *midasi,
+                                          gboolean okuri, gint *length) {
+    auto *self = toMmapDict(dict);
+    auto key = convertEncoding(midasi, self->encoding, "UTF-8");
+    if (!key) {
+        return newCandidateArray({}, length);
+    }
+    auto candidates = self->dictionary->lookup(*key, okuri);
+    if (candidates.empty()) {
+        return newCandidateArray({}, length);
+    }
+    auto decoded = convertEncoding(candidates, "UTF-8", self->encoding);
+    if (!decoded) {
+        return newCandidateArray({}, length);
+    }
+    return newCandidateArray(midasi, okuri, *decoded, length);
+}
+
+gchar **fcitx_skk_mmap_dict_complete(SkkDict *dict, const gchar *midasi,
+                                     gint *length) {
+    auto *self = toMmapDict(dict);
+    std::vector<std::string> completions;
+    if (auto prefix = convertEncoding(midasi, self->encoding, "UTF-8")) {
+        for (auto completion : self->dictionary->complete(*prefix)) {
+            if (auto decoded =
+                    convertEncoding(completion, "UTF-8", self->encoding)) {
+                completions.push_back(std::move(*decoded));
+            }
+        }
+    }
+    return newStringArray(completions, length);
+}
+
+gboolean fcitx_skk_mmap_dict_get_read_only(SkkDict * /*dict*/) { return TRUE; }
+
+void fcitx_skk_mmap_dict_init(FcitxSkkMmapDict * /*self*/) {}
+
+void fcitx_skk_mmap_dict_class_init(FcitxSkkMmapDictClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = fcitx_skk_mmap_dict_finalize;
+    auto *dictClass = SKK_DICT_CLASS(klass);
+    dictClass->reload = fcitx_skk_mmap_dict_reload;
+    dictClass->lookup = fcitx_skk_mmap_dict_lookup;
+    dictClass->complete = fcitx_skk_mmap_dict_complete;
+    dictClass->get_read_only = fcitx_skk_mmap_dict_get_read_only;
+}
+
+} // namespace
+
+SkkDict *newMmapDict(const std::string &path, const std::string &encoding) {
+    auto dictionary = std::make_unique<MmapDictionary>();
+    if (!dictionary->open(path)) {
+        return nullptr;
+    }
+    auto *self = static_cast<FcitxSkkMmapDict *>(
+        g_object_new(fcitx_skk_mmap_dict_get_type(), nullptr));
+    self->dictionary = dictionary.release();
+    self->path = g_strdup(path.data());
+    self->encoding = g_strdup(encoding.data());
+    return SKK_DICT(self);
+}
+
+} // namespace fcitx
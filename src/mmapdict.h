@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_MMAPDICT_H_
+#define _FCITX_SKK_MMAPDICT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <libskk/libskk.h>
+
+namespace fcitx {
+
+// Read only view of a file produced by compileDictionaryToMmap(). All
+// strings returned point into the mapping and are in the encoding of the
+// file.
+class MmapDictionary {
+public:
+    MmapDictionary() = default;
+    MmapDictionary(const MmapDictionary &) = delete;
+    ~MmapDictionary();
+
+    bool open(const std::string &path);
+
+    // Returns the candidates part of the line, e.g. "/a/b/".
+    std::string_view lookup(std::string_view midasi, bool okuri) const;
+
+    // Returns okuri-nasi midasi starting with prefix.
+    std::vector<std::string_view> complete(std::string_view prefix) const;
+
+    // Returns up to limit okuri-nasi entries whose midasi is longer than
+    // and starts with prefix, as pairs of midasi and candidates, in the
+    // order of midasi.
+    std::vector<std::pair<std::string_view, std::string_view>>
+    entries(std::string_view prefix, size_t limit) const;
+
+private:
+    uint32_t readUInt32(size_t offset) const;
+    std::string_view lineAt(size_t index, uint32_t pos) const;
+    static std::string_view midasiOf(std::string_view line);
+    uint32_t lowerBound(size_t index, uint32_t count,
+                        std::string_view midasi) const;
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t okuriAriIndex_ = 0;
+    size_t okuriNasiIndex_ = 0;
+    uint32_t okuriAriCount_ = 0;
+    uint32_t okuriNasiCount_ = 0;
+};
+
+// Create a readonly dictionary from a file produced by
+// compileDictionaryToMmap(). The file is mapped shared and only the pages
+// touched by binary search are faulted in, so multiple processes share the
+// same memory. Returns nullptr if the file is not valid.
+SkkDict *newMmapDict(const std::string &path, const std::string &encoding);
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_MMAPDICT_H_
@@ -0,0 +1,195 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "predictor.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/eventdispatcher.h>
+#include "dictcache.h"
+#include "dictutils.h"
+#include "mmapdict.h"
+#include "skklog.h"
+
+namespace fcitx {
+
+namespace {
+
+// A short prefix may match thousands of entries, only look at the first
+// ones in the order of reading.
+constexpr size_t maxScannedEntries = 1024;
+
+} // namespace
+
+bool PredictionIndex::addDictionary(const std::string &path) {
+    auto dictionary = std::make_unique<MmapDictionary>();
+    if (!dictionary->open(path)) {
+        return false;
+    }
+    dictionaries_.push_back(std::move(dictionary));
+    return true;
+}
+
+std::vector<Prediction> PredictionIndex::predict(std::string_view prefix,
+                                                 size_t limit) const {
+    std::vector<Prediction> result;
+    if (prefix.empty() || limit == 0) {
+        return result;
+    }
+
+    struct Match {
+        std::string_view midasi;
+        std::string_view candidates;
+        size_t dictionary;
+    };
+    std::vector<Match> matches;
+    for (size_t i = 0; i < dictionaries_.size(); i++) {
+        for (const auto &[midasi, candidates] :
+             dictionaries_[i]->entries(prefix, maxScannedEntries)) {
+            matches.push_back({midasi, candidates, i});
+        }
+    }
+    // The first ones in the order of reading, and the same reading keeps the
+    // dictionary order.
+    std::stable_sort(matches.begin(), matches.end(),
+                     [](const Match &lhs, const Match &rhs) {
+                         return lhs.midasi < rhs.midasi;
+                     });
+    if (matches.size() > maxScannedEntries) {
+        matches.resize(maxScannedEntries);
+    }
+    std::stable_sort(matches.begin(), matches.end(),
+                     [](const Match &lhs, const Match &rhs) {
+                         return lhs.midasi.size() < rhs.midasi.size();
+                     });
+
+    std::unordered_set<std::string_view> seen;
+    for (const auto &match : matches) {
+        for (const auto &[text, annotation] :
+             splitCandidates(match.candidates)) {
+            // Skip lisp expressions, they need to be evaluated by libskk.
+            if (text.starts_with('(') || !seen.insert(text).second) {
+                continue;
+            }
+            result.push_back({std::string(match.midasi), std::string(text)});
+            if (result.size() >= limit) {
+                return result;
+            }
+        }
+    }
+    return result;
+}
+
+Predictor::Predictor(EventDispatcher *dispatcher) : dispatcher_(dispatcher) {}
+
+Predictor::~Predictor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    condition_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void Predictor::setSources(std::vector<PredictionSource> sources) {
+    if (sources == sources_) {
+        return;
+    }
+    sources_ = sources;
+    if (!thread_.joinable()) {
+        if (sources.empty()) {
+            return;
+        }
+        thread_ = std::thread(&Predictor::run, this);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pendingSources_ = std::move(sources);
+    }
+    condition_.notify_one();
+}
+
+void Predictor::query(const void *owner, std::string prefix, size_t limit,
+                      Callback callback) {
+    if (!thread_.joinable()) {
+        // Without any source, the caller still gets an empty answer.
+        dispatcher_->schedule(
+            [callback = std::move(callback), prefix = std::move(prefix)]() {
+                callback(prefix, {});
+            });
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pendingQueries_[owner] = {std::move(prefix), limit,
+                                  std::move(callback)};
+    }
+    condition_.notify_one();
+}
+
+void Predictor::cancel(const void *owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pendingQueries_.erase(owner);
+}
+
+void Predictor::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        condition_.wait(lock, [this]() {
+            return quit_ || pendingSources_ || !pendingQueries_.empty();
+        });
+        if (quit_) {
+            return;
+        }
+
+        if (pendingSources_) {
+            auto sources = std::move(*pendingSources_);
+            pendingSources_.reset();
+            lock.unlock();
+            auto index = std::make_unique<PredictionIndex>();
+            for (const auto &source : sources) {
+                // Usually compiled already by the dictionary loader, it is
+                // UTF-8 like the prefix.
+                auto path = compiledDictionary(source.path, source.encoding,
+                                               DictionaryCacheFormat::Mmap);
+                if (path.empty() || !index->addDictionary(path.string())) {
+                    SKK_DEBUG() << "Failed to index " << source.path
+                                << " for prediction.";
+                }
+            }
+            SKK_DEBUG() << "Built prediction index of " << index->size()
+                        << " dictionaries.";
+            index_ = std::move(index);
+            lock.lock();
+            continue;
+        }
+
+        auto node = pendingQueries_.extract(pendingQueries_.begin());
+        lock.unlock();
+        auto &query = node.mapped();
+        std::vector<Prediction> predictions;
+        if (index_) {
+            predictions = index_->predict(query.prefix, query.limit);
+        }
+        dispatcher_->schedule([callback = std::move(query.callback),
+                               prefix = std::move(query.prefix),
+                               predictions = std::move(predictions)]() {
+            callback(prefix, predictions);
+        });
+        lock.lock();
+    }
+}
+
+} // namespace fcitx
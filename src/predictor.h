@@ -0,0 +1,105 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_PREDICTOR_H_
+#define _FCITX_SKK_PREDICTOR_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcitx-utils/eventdispatcher.h>
+#include "mmapdict.h"
+
+namespace fcitx {
+
+struct Prediction {
+    std::string reading;
+    std::string text;
+};
+
+// A text dictionary to build the prediction index from.
+struct PredictionSource {
+    std::string path;
+    std::string encoding;
+    // SkkDictionaryInfo::cacheKey(), which changes with the file.
+    std::string key;
+
+    bool operator==(const PredictionSource &other) const = default;
+};
+
+// Looks up the okuri-nasi entries of the mmap caches of the dictionaries,
+// which are already sorted by reading. Nothing is copied, so the index costs
+// no more memory than the pages the lookups touch.
+class PredictionIndex {
+public:
+    // Add a file produced by compileDictionaryToMmap().
+    bool addDictionary(const std::string &path);
+
+    // Returns up to limit words whose reading is longer than and starts with
+    // prefix. Shorter readings come first, then the dictionary order.
+    std::vector<Prediction> predict(std::string_view prefix,
+                                     size_t limit) const;
+
+    size_t size() const { return dictionaries_.size(); }
+
+private:
+    std::vector<std::unique_ptr<MmapDictionary>> dictionaries_;
+};
+
+// Builds the PredictionIndex and answers queries on a worker thread, so
+// neither blocks a key event. Results are delivered on the event loop of
+// dispatcher.
+class Predictor {
+public:
+    using Callback =
+        std::function<void(const std::string &, std::vector<Prediction>)>;
+
+    explicit Predictor(EventDispatcher *dispatcher);
+    ~Predictor();
+
+    // Rebuild the index from sources in background, unless they are the
+    // same as the current ones.
+    void setSources(std::vector<PredictionSource> sources);
+
+    // Look up words starting with prefix. A query replaces the pending one
+    // from the same owner, since only the latest preedit matters.
+    void query(const void *owner, std::string prefix, size_t limit,
+               Callback callback);
+    void cancel(const void *owner);
+
+private:
+    struct Query {
+        std::string prefix;
+        size_t limit = 0;
+        Callback callback;
+    };
+
+    void run();
+
+    EventDispatcher *dispatcher_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool quit_ = false;
+    std::optional<std::vector<PredictionSource>> pendingSources_;
+    // Only accessed from the main thread.
+    std::vector<PredictionSource> sources_;
+    std::unordered_map<const void *, Query> pendingQueries_;
+    // Only accessed from the worker thread.
+    std::unique_ptr<PredictionIndex> index_;
+    std::thread thread_;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_PREDICTOR_H_
@@ -0,0 +1,536 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "servdict.h"
+#include <netdb.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/unixfd.h>
+#include <glib-object.h>
+#include <glib.h>
+#include <libskk/libskk.h>
+#include "dictutils.h"
+#include "skklog.h"
+
+namespace fcitx {
+
+namespace {
+
+// Timeout of connecting and of each read or write on the server thread, in
+// milliseconds.
+constexpr int ioTimeout = 3000;
+// A lookup runs inside the key event, never block it longer than this, in
+// milliseconds.
+constexpr int maxLookupTimeout = 1000;
+// Requests that wait for the server thread. When the server is too slow to
+// keep up, the oldest one is dropped.
+constexpr size_t maxQueuedRequests = 16;
+// Answers that arrived after the deadline and are not fetched yet.
+constexpr size_t maxKeptAnswers = 64;
+// An idle connection is checked with a version request at this interval.
+constexpr std::chrono::seconds keepAliveInterval{30};
+// A server that fails is not tried again until the backoff passes, which
+// doubles on every failure in a row.
+constexpr std::chrono::milliseconds minBackoff{500};
+constexpr std::chrono::milliseconds maxBackoff{60000};
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps a connection to the first available server of a list, and sends
+// requests to it on its own thread. Connecting, reconnecting and health
+// checks all happen on that thread, so the main thread only ever waits for
+// the lookup deadline.
+class ServerClient {
+public:
+    ServerClient(const std::vector<SkkServerAddress> &servers,
+                 std::string encoding, int timeout)
+        : encoding_(std::move(encoding)),
+          // 0 used to mean no limit, which froze the input on a dead
+          // server.
+          timeout_(timeout > 0 ? std::min(timeout, maxLookupTimeout)
+                               : maxLookupTimeout),
+          wakeFd_(UnixFD::own(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))) {
+        for (const auto &address : servers) {
+            servers_.push_back({address, 0, {}});
+        }
+        thread_ = std::thread(&ServerClient::run, this);
+    }
+
+    ServerClient(const ServerClient &) = delete;
+
+    ~ServerClient() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        requestCondition_.notify_all();
+        if (wakeFd_.isValid()) {
+            uint64_t value = 1;
+            if (write(wakeFd_.fd(), &value, sizeof(value)) < 0) {
+                SKK_DEBUG() << "Failed to wake up skkserv thread.";
+            }
+        }
+        thread_.join();
+    }
+
+    // Sends "<command><key> " to the server and returns the answer without
+    // the leading "1", e.g. "/a/b/", or an empty string if the server has no
+    // entry. Returns nullopt if there is no answer before the deadline.
+    std::optional<std::string> query(char command, const std::string &key) {
+        auto encodedKey = convertEncoding(key, encoding_.data(), "UTF-8");
+        if (!encodedKey) {
+            lastQueryAnswered_ = true;
+            return std::string();
+        }
+        auto id = stringutils::concat(command, key);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto iter = requests_.find(id);
+        if (iter == requests_.end()) {
+            // Do not wait for servers that are known to be down, the server
+            // thread keeps trying to reconnect in background.
+            if (!available_) {
+                lastQueryAnswered_ = false;
+                return std::nullopt;
+            }
+            auto request = std::make_shared<Request>();
+            request->data = stringutils::concat(command, *encodedKey, " ");
+            queue(request);
+            iter = requests_.emplace(id, std::move(request)).first;
+        }
+        auto current = iter->second;
+        responseCondition_.wait_for(lock, std::chrono::milliseconds(timeout_),
+                                    [&current]() { return current->done; });
+        if (!current->done) {
+            SKK_DEBUG() << "skkserv did not answer in time: " << key;
+            lastQueryAnswered_ = false;
+            return std::nullopt;
+        }
+        requests_.erase(id);
+        lastQueryAnswered_ = current->answer.has_value();
+        return std::move(current->answer);
+    }
+
+    bool lastQueryAnswered() const { return lastQueryAnswered_; }
+
+    void reconnect() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reconnect_ = true;
+        }
+        requestCondition_.notify_one();
+    }
+
+private:
+    struct Request {
+        std::string data;
+        bool done = false;
+        std::optional<std::string> answer;
+    };
+
+    struct Server {
+        SkkServerAddress address;
+        int failures;
+        Clock::time_point retryTime;
+    };
+
+    // Called with mutex_ held.
+    void queue(const std::shared_ptr<Request> &request) {
+        if (queue_.size() >= maxQueuedRequests) {
+            auto dropped = queue_.front();
+            queue_.pop_front();
+            std::erase_if(requests_, [&dropped](const auto &item) {
+                return item.second == dropped;
+            });
+        }
+        if (requests_.size() > maxKeptAnswers) {
+            std::erase_if(requests_,
+                          [](const auto &item) { return item.second->done; });
+        }
+        queue_.push_back(request);
+        requestCondition_.notify_one();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            auto ready = [this]() {
+                return stop_ || reconnect_ || !queue_.empty();
+            };
+            if (auto time = nextMaintenanceTime();
+                time == Clock::time_point::max()) {
+                requestCondition_.wait(lock, ready);
+            } else {
+                requestCondition_.wait_until(lock, time, ready);
+            }
+            if (stop_) {
+                break;
+            }
+            if (reconnect_) {
+                reconnect_ = false;
+                disconnect();
+                for (auto &server : servers_) {
+                    server.failures = 0;
+                    server.retryTime = {};
+                }
+            }
+            std::shared_ptr<Request> request;
+            if (!queue_.empty()) {
+                request = std::move(queue_.front());
+                queue_.pop_front();
+            }
+
+            lock.unlock();
+            std::optional<std::string> answer;
+            if (request) {
+                answer = send(request->data);
+            } else {
+                maintain();
+            }
+            lock.lock();
+
+            available_ = socket_.isValid() || retryableServer() != nullptr;
+            if (request) {
+                request->done = true;
+                request->answer = std::move(answer);
+                responseCondition_.notify_all();
+            }
+        }
+        disconnect();
+    }
+
+    // Things done when there is no request: connect to the most preferred
+    // server that may be up, and check whether the connection still works.
+    void maintain() {
+        const auto *preferred = retryableServer();
+        if (!socket_.isValid() ||
+            (preferred && preferred < &servers_[current_])) {
+            disconnect();
+            connect();
+            return;
+        }
+        if (Clock::now() - lastActivity_ < keepAliveInterval) {
+            return;
+        }
+        std::string version;
+        if (writeAll("2") && read(' ', version)) {
+            lastActivity_ = Clock::now();
+            return;
+        }
+        SKK_DEBUG() << "Lost connection to skkserv "
+                    << servers_[current_].address.host << ":"
+                    << servers_[current_].address.port;
+        socket_.reset();
+        markFailed(servers_[current_]);
+        connect();
+    }
+
+    Clock::time_point nextMaintenanceTime() const {
+        auto time = Clock::time_point::max();
+        if (socket_.isValid()) {
+            time = lastActivity_ + keepAliveInterval;
+        }
+        const size_t end = socket_.isValid() ? current_ : servers_.size();
+        for (size_t i = 0; i < end; i++) {
+            time = std::min(time, servers_[i].retryTime);
+        }
+        return time;
+    }
+
+    // Returns the first server that is not in backoff.
+    const Server *retryableServer() const {
+        const auto now = Clock::now();
+        for (const auto &server : servers_) {
+            if (server.retryTime <= now) {
+                return &server;
+            }
+        }
+        return nullptr;
+    }
+
+    void markFailed(Server &server) {
+        server.failures += 1;
+        auto backoff = minBackoff * (1 << std::min(server.failures - 1, 16));
+        server.retryTime = Clock::now() + std::min(backoff, maxBackoff);
+        SKK_DEBUG() << "skkserv " << server.address.host << ":"
+                    << server.address.port << " failed " << server.failures
+                    << " times in a row.";
+    }
+
+    std::optional<std::string> send(std::string_view data) {
+        // A kept connection may have been closed by the server, so retry
+        // once with a new one.
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (!socket_.isValid() && !connect()) {
+                return std::nullopt;
+            }
+            std::string line;
+            if (writeAll(data) && read('\n', line)) {
+                lastActivity_ = Clock::now();
+                if (!line.starts_with('1')) {
+                    return std::string();
+                }
+                auto answer = convertEncoding(std::string_view(line).substr(1),
+                                              "UTF-8", encoding_.data());
+                return answer ? std::move(*answer) : std::string();
+            }
+            socket_.reset();
+            if (attempt > 0) {
+                markFailed(servers_[current_]);
+            }
+        }
+        return std::nullopt;
+    }
+
+    void disconnect() {
+        if (socket_.isValid()) {
+            ::send(socket_.fd(), "0", 1, MSG_NOSIGNAL);
+            socket_.reset();
+        }
+    }
+
+    // Connect to the first server that is not in backoff.
+    bool connect() {
+        const auto now = Clock::now();
+        for (size_t i = 0; i < servers_.size(); i++) {
+            auto &server = servers_[i];
+            if (server.retryTime > now) {
+                continue;
+            }
+            if (auto fd = connect(server.address); fd.isValid()) {
+                SKK_DEBUG() << "Connected to skkserv " << server.address.host
+                            << ":" << server.address.port;
+                socket_ = std::move(fd);
+                current_ = i;
+                lastActivity_ = Clock::now();
+                server.failures = 0;
+                return true;
+            }
+            markFailed(server);
+        }
+        return false;
+    }
+
+    UnixFD connect(const SkkServerAddress &address) {
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *result = nullptr;
+        const auto port = std::to_string(address.port);
+        if (getaddrinfo(address.host.data(), port.data(), &hints, &result) !=
+            0) {
+            return {};
+        }
+        UnixFD socket;
+        for (auto *addr = result; addr; addr = addr->ai_next) {
+            auto fd = UnixFD::own(
+                ::socket(addr->ai_family,
+                         addr->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                         addr->ai_protocol));
+            if (!fd.isValid()) {
+                continue;
+            }
+            if (::connect(fd.fd(), addr->ai_addr, addr->ai_addrlen) != 0) {
+                if (errno != EINPROGRESS || !wait(fd.fd(), POLLOUT)) {
+                    continue;
+                }
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(fd.fd(), SOL_SOCKET, SO_ERROR, &error,
+                               &length) != 0 ||
+                    error != 0) {
+                    continue;
+                }
+            }
+            socket = std::move(fd);
+            break;
+        }
+        freeaddrinfo(result);
+        return socket;
+    }
+
+    bool writeAll(std::string_view data) {
+        while (!data.empty()) {
+            auto written =
+                ::send(socket_.fd(), data.data(), data.size(), MSG_NOSIGNAL);
+            if (written > 0) {
+                data.remove_prefix(written);
+            } else if (written < 0 && errno == EINTR) {
+                continue;
+            } else if (written < 0 && errno == EAGAIN) {
+                if (!wait(socket_.fd(), POLLOUT)) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Read until delimiter, which is not included in the result.
+    bool read(char delimiter, std::string &result) {
+        char buffer[4096];
+        while (true) {
+            auto length = recv(socket_.fd(), buffer, sizeof(buffer), 0);
+            if (length > 0) {
+                result.append(buffer, length);
+                if (auto end = result.find(delimiter);
+                    end != std::string::npos) {
+                    result.erase(end);
+                    return true;
+                }
+            } else if (length < 0 && errno == EINTR) {
+                continue;
+            } else if (length < 0 && errno == EAGAIN) {
+                if (!wait(socket_.fd(), POLLIN)) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        }
+    }
+
+    // Returns false on timeout or when the client is being destroyed.
+    bool wait(int fd, short events) {
+        struct pollfd fds[2] = {{fd, events, 0}, {wakeFd_.fd(), POLLIN, 0}};
+        int ret;
+        do {
+            ret = poll(fds, wakeFd_.isValid() ? 2 : 1, ioTimeout);
+        } while (ret < 0 && errno == EINTR);
+        return ret > 0 && fds[0].revents != 0 && fds[1].revents == 0;
+    }
+
+    const std::string encoding_;
+    const int timeout_;
+
+    std::mutex mutex_;
+    std::condition_variable requestCondition_;
+    std::condition_variable responseCondition_;
+    std::deque<std::shared_ptr<Request>> queue_;
+    // Requests indexed by command and key, an entry is removed once its
+    // answer is returned by query().
+    std::unordered_map<std::string, std::shared_ptr<Request>> requests_;
+    bool stop_ = false;
+    bool reconnect_ = false;
+    // Whether there is a connection, or a server that may be connected.
+    bool available_ = true;
+
+    // Only used by the main thread.
+    bool lastQueryAnswered_ = true;
+
+    // Only used by the server thread.
+    std::vector<Server> servers_;
+    size_t current_ = 0;
+    UnixFD socket_;
+    Clock::time_point lastActivity_;
+
+    UnixFD wakeFd_;
+    std::thread thread_;
+};
+
+struct FcitxSkkServDict {
+    SkkDict parent_instance;
+    ServerClient *client;
+};
+
+struct FcitxSkkServDictClass {
+    SkkDictClass parent_class;
+};
+
+G_DEFINE_TYPE(FcitxSkkServDict, fcitx_skk_serv_dict, SKK_TYPE_DICT)
+
+FcitxSkkServDict *toServDict(SkkDict *dict) {
+    return reinterpret_cast<FcitxSkkServDict *>(dict);
+}
+
+void fcitx_skk_serv_dict_finalize(GObject *object) {
+    auto *self = reinterpret_cast<FcitxSkkServDict *>(object);
+    delete self->client;
+    G_OBJECT_CLASS(fcitx_skk_serv_dict_parent_class)->finalize(object);
+}
+
+void fcitx_skk_serv_dict_reload(SkkDict *dict, GError ** /*error*/) {
+    toServDict(dict)->client->reconnect();
+}
+
+SkkCandidate **fcitx_skk_serv_dict_lookup(SkkDict *dict, const gchar *midasi,
+                                          gboolean okuri, gint *length) {
+    auto *self = toServDict(dict);
+    auto answer = self->client->query('1', midasi);
+    if (!answer || answer->empty()) {
+        return newCandidateArray({}, length);
+    }
+    return newCandidateArray(midasi, okuri, *answer, length);
+}
+
+gchar **fcitx_skk_serv_dict_complete(SkkDict *dict, const gchar *midasi,
+                                     gint *length) {
+    auto *self = toServDict(dict);
+    std::vector<std::string> completions;
+    if (auto answer = self->client->query('4', midasi)) {
+        for (const auto &[text, annotation] : splitCandidates(*answer)) {
+            completions.emplace_back(text);
+        }
+    }
+    return newStringArray(completions, length);
+}
+
+gboolean fcitx_skk_serv_dict_get_read_only(SkkDict * /*dict*/) { return TRUE; }
+
+void fcitx_skk_serv_dict_init(FcitxSkkServDict * /*self*/) {}
+
+void fcitx_skk_serv_dict_class_init(FcitxSkkServDictClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = fcitx_skk_serv_dict_finalize;
+    auto *dictClass = SKK_DICT_CLASS(klass);
+    dictClass->reload = fcitx_skk_serv_dict_reload;
+    dictClass->lookup = fcitx_skk_serv_dict_lookup;
+    dictClass->complete = fcitx_skk_serv_dict_complete;
+    dictClass->get_read_only = fcitx_skk_serv_dict_get_read_only;
+}
+
+} // namespace
+
+SkkDict *newServerDict(const std::vector<SkkServerAddress> &servers,
+                       const std::string &encoding, int timeout) {
+    if (servers.empty()) {
+        return nullptr;
+    }
+    auto *self = static_cast<FcitxSkkServDict *>(
+        g_object_new(fcitx_skk_serv_dict_get_type(), nullptr));
+    self->client = new ServerClient(servers, encoding, timeout);
+    return SKK_DICT(self);
+}
+
+bool isServerDictLookupPending(SkkDict *dict) {
+    if (!G_TYPE_CHECK_INSTANCE_TYPE(dict, fcitx_skk_serv_dict_get_type())) {
+        return false;
+    }
+    return !toServDict(dict)->client->lastQueryAnswered();
+}
+
+} // namespace fcitx
@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_SERVDICT_H_
+#define _FCITX_SKK_SERVDICT_H_
+
+#include <string>
+#include <vector>
+#include <libskk/libskk.h>
+
+namespace fcitx {
+
+struct SkkServerAddress {
+    std::string host;
+    int port = 0;
+};
+
+// Create a dictionary that queries a skkserv on its own thread. The
+// connection is kept alive, and when a server is down the next one in
+// servers is used until the former comes back. A lookup waits timeout
+// milliseconds for the server, at most one second, which is also the wait
+// for a timeout of 0. It returns nothing if the server does not answer in
+// time. The late answer is kept, and returned by the next lookup of the same
+// midasi, e.g. when the user converts again. It is not merged into a
+// candidate list already shown, libskk has no interface to add candidates to
+// it.
+SkkDict *newServerDict(const std::vector<SkkServerAddress> &servers,
+                       const std::string &encoding, int timeout);
+
+// Whether the last lookup of dict got no answer from the server, because it
+// is late or unreachable. Such result should not be cached.
+bool isServerDictLookupPending(SkkDict *dict);
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_SERVDICT_H_
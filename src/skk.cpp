@@ -6,8 +6,11 @@
  */
 #include "skk.h"
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <charconv>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -17,10 +20,13 @@
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include <fcitx-config/iniparser.h>
 #include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/charutils.h>
 #include <fcitx-utils/fdstreambuf.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/key.h>
@@ -48,17 +54,23 @@
 #include <glib-object.h>
 #include <glib.h>
 #include <libskk/libskk.h>
-
-#define SKK_DEBUG() FCITX_LOGC(::fcitx::skk_logcategory, Debug)
+#include "cachedict.h"
+#include "dictcache.h"
+#include "mmapdict.h"
+#include "servdict.h"
+#include "skklog.h"
+#include "skktrace.h"
+#include "userdict.h"
 
 namespace fcitx {
 
-namespace {
-
 FCITX_DEFINE_LOG_CATEGORY(skk_logcategory, "skk");
 
-Text skkContextGetPreedit(SkkContext *context) {
-    Text preedit;
+namespace {
+
+// Fills preedit in place, so the storage of the segments is reused.
+void skkContextGetPreedit(SkkContext *context, Text &preedit) {
+    preedit.clear();
 
     const gchar *preeditString = skk_context_get_preedit(context);
     size_t len = strlen(preeditString);
@@ -88,7 +100,84 @@ Text skkContextGetPreedit(SkkContext *context) {
     }
 
     preedit.setCursor(len);
-    return preedit;
+}
+
+// Distinct key and modifier combinations are few in practice, this only
+// bounds the cache against a stream of unusual keys.
+constexpr size_t maxCachedKeyEvents = 512;
+
+// Log the key event statistics every this many key events.
+constexpr uint64_t keyStatisticsLogInterval = 1000;
+
+// Predictions are only looked up once the reading is this long, otherwise
+// there are too many of them to be useful.
+constexpr size_t minPredictionLength = 2;
+
+// Returns the reading typed so far in the "▽" state, or an empty string if
+// there is nothing to predict.
+std::string predictionPrefix(std::string_view preedit) {
+    if (!stringutils::consumePrefix(preedit, "\xe2\x96\xbd")) {
+        return {};
+    }
+    // Drop the romaji that is not converted yet.
+    while (!preedit.empty() && charutils::islower(preedit.back())) {
+        preedit.remove_suffix(1);
+    }
+    // Anything else in ASCII means okuri or abbrev input.
+    if (std::any_of(preedit.begin(), preedit.end(), [](char c) {
+            return static_cast<unsigned char>(c) < 0x80;
+        })) {
+        return {};
+    }
+    if (utf8::lengthValidated(preedit) == utf8::INVALID_LENGTH ||
+        utf8::length(preedit) < minPredictionLength) {
+        return {};
+    }
+    return std::string(preedit);
+}
+
+bool isSameText(const Text &lhs, const Text &rhs) {
+    if (lhs.size() != rhs.size() || lhs.cursor() != rhs.cursor()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); i++) {
+        if (lhs.stringAt(i) != rhs.stringAt(i) ||
+            lhs.formatAt(i) != rhs.formatAt(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Everything of a candidate list that shows up in the user interface.
+// It is built into signature, so its storage is reused.
+void candidateListSignature(const CandidateList &candidateList,
+                            std::string &signature) {
+    auto appendText = [&signature](const Text &text) {
+        for (size_t i = 0; i < text.size(); i++) {
+            signature.append(text.stringAt(i));
+        }
+        signature.push_back('\0');
+    };
+    auto appendNumber = [&signature](int value) {
+        std::array<char, 16> buffer;
+        auto result =
+            std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+        signature.append(buffer.data(), result.ptr);
+        signature.push_back(':');
+    };
+    signature.clear();
+    for (int i = 0; i < candidateList.size(); i++) {
+        const auto &candidate = candidateList.candidate(i);
+        appendText(candidateList.label(i));
+        appendText(candidate.text());
+        appendText(candidate.comment());
+    }
+    const auto *pageable = candidateList.toPageable();
+    appendNumber(candidateList.cursorIndex());
+    appendNumber(static_cast<int>(candidateList.layoutHint()));
+    appendNumber(pageable && pageable->hasPrev());
+    appendNumber(pageable && pageable->hasNext());
 }
 
 struct {
@@ -106,7 +195,7 @@ struct {
 
 auto inputModeStatus(SkkEngine *engine, InputContext *ic) {
     auto *state = engine->state(ic);
-    auto mode = skk_context_get_input_mode(state->context());
+    auto mode = state->inputMode();
     return (mode >= 0 && mode < FCITX_ARRAY_SIZE(input_mode_status))
                ? &input_mode_status[mode]
                : nullptr;
@@ -155,11 +244,11 @@ public:
     }
     bool isChecked(InputContext *ic) const override {
         auto *state = engine_->state(ic);
-        return mode_ == skk_context_get_input_mode(state->context());
+        return mode_ == state->inputMode();
     }
     void activate(InputContext *ic) override {
         auto *state = engine_->state(ic);
-        skk_context_set_input_mode(state->context(), mode_);
+        state->setInputMode(mode_);
     }
 
 private:
@@ -191,6 +280,89 @@ private:
     int idx_;
 };
 
+class SkkPredictionCandidateWord : public CandidateWord {
+public:
+    SkkPredictionCandidateWord(SkkEngine *engine, Text text, Text comment,
+                               int idx)
+        : engine_(engine), idx_(idx) {
+        setText(std::move(text));
+        setComment(std::move(comment));
+    }
+
+    void select(InputContext *inputContext) const override {
+        engine_->state(inputContext)->selectPrediction(idx_);
+    }
+
+private:
+    SkkEngine *engine_;
+    int idx_;
+};
+
+// One page of the libskk candidate list, as shown by fcitx.
+struct SkkCandidatePage {
+    std::vector<Text> labels;
+    std::vector<std::unique_ptr<SkkCandidateWord>> words;
+};
+
+std::shared_ptr<const SkkCandidatePage>
+SkkCandidatePageCache::page(SkkEngine *engine, SkkCandidateList *candidates,
+                            int index) {
+    const gint size = skk_candidate_list_get_size(candidates);
+    const guint pageStart = skk_candidate_list_get_page_start(candidates);
+    const guint pageSize = skk_candidate_list_get_page_size(candidates);
+    const bool showAnnotation = *engine->config().showAnnotation;
+    const auto chooseKey = *engine->config().candidateChooseKey;
+    if (size != size_ || pageStart != pageStart_ || pageSize != pageSize_ ||
+        showAnnotation != showAnnotation_ || chooseKey != chooseKey_) {
+        pages_.clear();
+        size_ = size;
+        pageStart_ = pageStart;
+        pageSize_ = pageSize;
+        showAnnotation_ = showAnnotation;
+        chooseKey_ = chooseKey;
+    }
+    auto &page = pages_[index];
+    if (page) {
+        return page;
+    }
+
+    constexpr char labels[3][11] = {
+        "1234567890",
+        "abcdefghij",
+        "asdfghjkl;",
+    };
+
+    auto newPage = std::make_shared<SkkCandidatePage>();
+    const int pageFirst = (index * pageSize) + pageStart;
+    const int pageLast = std::min(size, static_cast<int>(pageFirst + pageSize));
+    for (int i = pageFirst; i < pageLast; i++) {
+        GObjectUniquePtr<SkkCandidate> skkCandidate{
+            skk_candidate_list_get(candidates, i)};
+        Text text;
+        text.append(skk_candidate_get_text(skkCandidate.get()));
+        Text comment;
+        if (showAnnotation) {
+            const auto *annotation =
+                skk_candidate_get_annotation(skkCandidate.get());
+            // Make sure annotation is not null, empty, or equal to "?".
+            // ? seems to be a special debug purpose value.
+            if (annotation && annotation[0] &&
+                g_strcmp0(annotation, "?") != 0) {
+                comment.append(stringutils::concat("[", annotation, "]"));
+            }
+        }
+
+        char label[2] = {
+            labels[static_cast<int>(chooseKey)][(i - pageFirst) % 10], '\0'};
+
+        newPage->labels.emplace_back(stringutils::concat(label, ". "));
+        newPage->words.emplace_back(std::make_unique<SkkCandidateWord>(
+            engine, std::move(text), std::move(comment), i - pageStart));
+    }
+    page = std::move(newPage);
+    return page;
+}
+
 class SkkFcitxCandidateList : public CandidateList,
                               public PageableCandidateList,
                               public CursorMovableCandidateList {
@@ -199,6 +371,11 @@ public:
         : engine_(engine), ic_(ic) {
         setPageable(this);
         setCursorMovable(this);
+        update();
+    }
+
+    // Follow the current page and cursor of libskk.
+    void update() {
         auto *skkstate = engine_->state(ic_);
         auto *context = skkstate->context();
         SkkCandidateList *skkCandidates = skk_context_get_candidates(context);
@@ -215,48 +392,21 @@ public:
         int currentPage = (cursor_pos - page_start) / page_size;
         int totalPage = (size - page_start + page_size - 1) / page_size;
         int pageFirst = (currentPage * page_size) + page_start;
-        int pageLast = std::min(size, static_cast<int>(pageFirst + page_size));
-
-        for (int i = pageFirst; i < pageLast; i++) {
-            GObjectUniquePtr<SkkCandidate> skkCandidate{
-                skk_candidate_list_get(skkCandidates, i)};
-            Text text;
-            text.append(skk_candidate_get_text(skkCandidate.get()));
-            Text comment;
-            if (*engine->config().showAnnotation) {
-                const auto *annotation =
-                    skk_candidate_get_annotation(skkCandidate.get());
-                // Make sure annotation is not null, empty, or equal to "?".
-                // ? seems to be a special debug purpose value.
-                if (annotation && annotation[0] &&
-                    g_strcmp0(annotation, "?") != 0) {
-                    comment.append(stringutils::concat(
-                        "[", skk_candidate_get_annotation(skkCandidate.get()),
-                        "]"));
-                }
-            }
-            if (i == cursor_pos) {
-                cursorIndex_ = i - pageFirst;
-            }
-
-            constexpr char labels[3][11] = {
-                "1234567890",
-                "abcdefghij",
-                "asdfghjkl;",
-            };
 
-            char label[2] = {labels[static_cast<int>(
-                                 engine_->config().candidateChooseKey.value())]
-                                   [(i - pageFirst) % 10],
-                             '\0'};
-
-            labels_.emplace_back(stringutils::concat(label, ". "));
-            words_.emplace_back(std::make_unique<SkkCandidateWord>(
-                engine, std::move(text), std::move(comment), i - page_start));
+        cursorIndex_ = -1;
+        // Moving the cursor within a page or going back to a page shown
+        // before only needs the cursor to be updated.
+        SKK_TRACE2(candidate_list_entry, size, currentPage);
+        page_ = skkstate->candidatePages().page(engine_, skkCandidates,
+                                                currentPage);
+        if (cursor_pos >= pageFirst &&
+            cursor_pos - pageFirst < static_cast<int>(page_->words.size())) {
+            cursorIndex_ = cursor_pos - pageFirst;
         }
 
         hasPrev_ = currentPage != 0;
         hasNext_ = currentPage + 1 < totalPage;
+        SKK_TRACE1(candidate_list_return, page_->words.size());
     }
 
     bool hasPrev() const override { return hasPrev_; }
@@ -273,13 +423,13 @@ public:
 
     void nextCandidate() override { moveCursor(false); }
 
-    const Text &label(int idx) const override { return labels_[idx]; }
+    const Text &label(int idx) const override { return page_->labels[idx]; }
 
     const CandidateWord &candidate(int idx) const override {
-        return *words_[idx];
+        return *page_->words[idx];
     }
 
-    int size() const override { return words_.size(); }
+    int size() const override { return page_->words.size(); }
 
     int cursorIndex() const override { return cursorIndex_; }
 
@@ -317,8 +467,7 @@ private:
 
     SkkEngine *engine_;
     InputContext *ic_;
-    std::vector<Text> labels_;
-    std::vector<std::unique_ptr<SkkCandidateWord>> words_;
+    std::shared_ptr<const SkkCandidatePage> page_;
     int cursorIndex_ = -1;
     bool hasPrev_ = false;
     bool hasNext_ = false;
@@ -329,11 +478,15 @@ private:
 
 SkkEngine::SkkEngine(Instance *instance)
     : instance_{instance}, factory_([this](InputContext &ic) {
-          auto *newState = new SkkState(this, &ic);
-          newState->applyConfig();
-          return newState;
+          return new SkkState(this, &ic);
       }) {
     skk_init();
+    dispatcher_.attach(&instance_->eventLoop());
+    dictionaryWatcher_ = std::make_unique<DictionaryWatcher>(
+        &instance_->eventLoop(), [this]() {
+            SKK_DEBUG() << "Reload dictionaries for file change.";
+            reloadDictionary();
+        });
 
     modeAction_ = std::make_unique<SkkModeAction>(this);
     menu_ = std::make_unique<Menu>();
@@ -365,12 +518,6 @@ SkkEngine::SkkEngine(Instance *instance)
     }
 
     instance_->inputContextManager().registerProperty("skkState", &factory_);
-    instance_->inputContextManager().foreach([this](InputContext *ic) {
-        auto *state = this->state(ic);
-        skk_context_set_input_mode(state->context(), *config_.inputMode);
-        ic->updateProperty(&factory_);
-        return true;
-    });
 }
 
 void SkkEngine::activate(const InputMethodEntry &entry,
@@ -379,14 +526,18 @@ void SkkEngine::activate(const InputMethodEntry &entry,
 
     auto &statusArea = event.inputContext()->statusArea();
     statusArea.addAction(StatusGroup::InputMethod, modeAction_.get());
+    // Set up the state now rather than on the first key.
+    state(event.inputContext())->context();
 }
 
 void SkkEngine::deactivate(const InputMethodEntry &entry,
                            InputContextEvent &event) {
-    if (event.type() == EventType::InputContextSwitchInputMethod) {
-        auto *skkstate = this->state(event.inputContext());
+    auto *skkstate = this->state(event.inputContext());
+    if (event.type() == EventType::InputContextSwitchInputMethod &&
+        skkstate->hasContext()) {
         auto *context = skkstate->context();
-        auto text = skkContextGetPreedit(context);
+        Text text;
+        skkContextGetPreedit(context, text);
         auto str = text.toString();
         if (!str.empty()) {
             event.inputContext()->commitString(str);
@@ -400,21 +551,76 @@ void SkkEngine::keyEvent(const InputMethodEntry &entry, KeyEvent &keyEvent) {
 
     auto *ic = keyEvent.inputContext();
     auto *state = ic->propertyFor(&factory_);
-    state->keyEvent(keyEvent);
+    {
+        ScopedKeyPhase phase(statistics_, SkkKeyPhase::Total);
+        SKK_TRACE2(key_event_entry, keyEvent.rawKey().sym(),
+                   state->inputMode());
+        state->keyEvent(keyEvent);
+        SKK_TRACE2(key_event_return, keyEvent.rawKey().sym(),
+                   keyEvent.filtered());
+    }
+    statistics_.countFiltered(keyEvent.filtered());
+    if (statistics_.keyEvents() % keyStatisticsLogInterval == 0) {
+        SKK_DEBUG() << "Key event statistics:\n" << statistics_.toString();
+    }
 }
 
 void SkkEngine::reloadConfig() {
     readAsIni(config_, "conf/skk.conf");
+    updateSelectionKeys();
 
+    // An explicit reload also picks up the rule and dictionary files changed
+    // on disk, unchanged dictionaries are reused anyway.
     loadDictionary();
     loadRule();
 
-    if (factory_.registered()) {
-        instance_->inputContextManager().foreach([this](InputContext *ic) {
-            auto *state = this->state(ic);
-            state->applyConfig();
-            return true;
-        });
+    // Input contexts pick up the change the next time they are used.
+    ++configGeneration_.options;
+    ++configGeneration_.rule;
+    if (contextPool_.size() > static_cast<size_t>(*config_.contextPoolSize)) {
+        contextPool_.resize(*config_.contextPoolSize);
+    }
+    for (const auto &context : contextPool_) {
+        configureContext(context.get());
+    }
+}
+
+void SkkEngine::applyConfigChanges(const SkkConfig &oldConfig) {
+    if (*oldConfig.candidateChooseKey != *config_.candidateChooseKey) {
+        updateSelectionKeys();
+    }
+    // Other options, like the candidate layout and keys, are read whenever
+    // they are used, so there is nothing to apply.
+    if (*oldConfig.nTriggersToShowCandWin != *config_.nTriggersToShowCandWin ||
+        *oldConfig.pageSize != *config_.pageSize ||
+        *oldConfig.punctuationStyle != *config_.punctuationStyle ||
+        *oldConfig.eggLikeNewLine != *config_.eggLikeNewLine) {
+        ++configGeneration_.options;
+        for (const auto &context : contextPool_) {
+            applyOptions(context.get());
+        }
+    }
+
+    if (*oldConfig.rule != *config_.rule) {
+        loadRule();
+        ++configGeneration_.rule;
+        for (const auto &context : contextPool_) {
+            applyRule(context.get());
+        }
+    }
+
+    if (*oldConfig.watchDictionaries != *config_.watchDictionaries ||
+        *oldConfig.predictiveCompletion != *config_.predictiveCompletion) {
+        // Dictionaries are all reused, this only updates what is derived
+        // from them.
+        loadDictionary();
+    } else if (*oldConfig.lookupCacheSize != *config_.lookupCacheSize) {
+        updateCachedDictionary();
+        applyDictionariesToStates();
+    }
+
+    if (contextPool_.size() > static_cast<size_t>(*config_.contextPoolSize)) {
+        contextPool_.resize(*config_.contextPoolSize);
     }
 }
 void SkkEngine::reset(const InputMethodEntry &entry, InputContextEvent &event) {
@@ -422,7 +628,20 @@ void SkkEngine::reset(const InputMethodEntry &entry, InputContextEvent &event) {
     auto *state = this->state(event.inputContext());
     state->reset();
 }
-void SkkEngine::save() {}
+void SkkEngine::save() {
+    for (const auto &dict : dictionaries_) {
+        if (skk_dict_get_read_only(dict.get())) {
+            continue;
+        }
+        GError *error = nullptr;
+        skk_dict_save(dict.get(), &error);
+        if (error) {
+            FCITX_LOGC(skk_logcategory, Error)
+                << "Failed to save dictionary: " << error->message;
+            g_error_free(error);
+        }
+    }
+}
 
 std::string SkkEngine::subMode(const InputMethodEntry & /*entry*/,
                                InputContext &ic) {
@@ -440,7 +659,72 @@ std::string SkkEngine::subModeLabelImpl(const InputMethodEntry & /*unused*/,
     return "";
 }
 
+void SkkEngine::updateSelectionKeys() {
+    std::array<KeySym, 10> syms = {
+        FcitxKey_1, FcitxKey_2, FcitxKey_3, FcitxKey_4, FcitxKey_5,
+        FcitxKey_6, FcitxKey_7, FcitxKey_8, FcitxKey_9, FcitxKey_0,
+    };
+    if (*config_.candidateChooseKey == CandidateChooseKey::ABC) {
+        syms = {
+            FcitxKey_a, FcitxKey_b, FcitxKey_c, FcitxKey_d, FcitxKey_e,
+            FcitxKey_f, FcitxKey_g, FcitxKey_h, FcitxKey_i, FcitxKey_j,
+        };
+    } else if (*config_.candidateChooseKey == CandidateChooseKey::Qwerty) {
+        syms = {
+            FcitxKey_a, FcitxKey_s,         FcitxKey_d, FcitxKey_f,
+            FcitxKey_g, FcitxKey_h,         FcitxKey_j, FcitxKey_k,
+            FcitxKey_l, FcitxKey_semicolon,
+        };
+    }
+
+    selectionKeys_.clear();
+    KeyStates states;
+    for (auto sym : syms) {
+        selectionKeys_.emplace_back(sym, states);
+    }
+}
+
+SkkKeyEvent *SkkEngine::skkKeyEvent(KeySym sym, uint32_t modifiers) {
+    const uint64_t id = (static_cast<uint64_t>(sym) << 32) | modifiers;
+    if (auto iter = keyEventCache_.find(id); iter != keyEventCache_.end()) {
+        return iter->second.event.get();
+    }
+    // Only reached by unusual keys once the common ones are cached.
+    if (keyEventCache_.size() >= maxCachedKeyEvents) {
+        keyEventCache_.clear();
+    }
+    GObjectUniquePtr<SkkKeyEvent> event{skk_key_event_new_from_x_keysym(
+        sym, static_cast<SkkModifierType>(modifiers), nullptr)};
+    if (!event) {
+        return nullptr;
+    }
+    auto *key = event.get();
+    keyEventCache_.emplace(
+        id, CachedKeyEvent{std::move(event), skk_key_event_get_modifiers(key),
+                           skk_key_event_get_code(key),
+                           skk_key_event_get_name(key)});
+    return key;
+}
+
+void SkkEngine::releaseSkkKeyEvent(KeySym sym, uint32_t modifiers) {
+    const uint64_t id = (static_cast<uint64_t>(sym) << 32) | modifiers;
+    auto iter = keyEventCache_.find(id);
+    if (iter == keyEventCache_.end()) {
+        return;
+    }
+    // Dropping our reference leaves the event to whoever else holds it.
+    const auto &cached = iter->second;
+    auto *key = cached.event.get();
+    if (G_OBJECT(key)->ref_count != 1 ||
+        skk_key_event_get_modifiers(key) != cached.modifiers ||
+        skk_key_event_get_code(key) != cached.code ||
+        skk_key_event_get_name(key) != cached.name) {
+        keyEventCache_.erase(iter);
+    }
+}
+
 void SkkEngine::loadRule() {
+    SKK_TRACE1(load_rule_entry, config_.rule->data());
     UniqueCPtr<SkkRuleMetadata, skk_rule_metadata_free> meta{
         skk_rule_find_rule(config_.rule->data())};
 
@@ -458,21 +742,30 @@ void SkkEngine::loadRule() {
         }
     }
 
+    SKK_TRACE1(load_rule_return, rule ? meta->name : nullptr);
     if (!rule) {
         return;
     }
     userRule_ = std::move(rule);
+    // The simple filter drops every key release before it reaches the
+    // context, other filters, e.g. nicola, use them.
+    ruleIgnoresRelease_ = g_strcmp0(meta->filter, "simple") == 0;
+    releaseFiltered_.reset();
 }
 
-enum class FcitxSkkDictType { FSDT_Invalid, FSDT_File, FSTD_Server };
+namespace {
 
-void SkkEngine::loadDictionary() {
-    dictionaries_.clear();
+// Loading is mostly bound by IO and parsing of the largest dictionary, more
+// threads than this do not help.
+constexpr unsigned int maxLoaderThreads = 4;
+
+std::vector<SkkDictionaryInfo> readDictionaryList() {
+    std::vector<SkkDictionaryInfo> infos;
     auto file = StandardPaths::global().open(StandardPathsType::PkgData,
                                              "skk/dictionary_list");
 
     if (!file.isValid()) {
-        return;
+        return infos;
     }
 
     IFDStreamBuf buf(file.fd());
@@ -489,12 +782,10 @@ void SkkEngine::loadDictionary() {
 
         SKK_DEBUG() << "Load dictionary: " << trimmed;
 
-        FcitxSkkDictType type = FcitxSkkDictType::FSDT_Invalid;
-        int mode = 0;
-        std::string path;
-        std::string host;
+        SkkDictionaryInfo info;
+        SkkServerAddress address;
         std::string port;
-        std::string encoding;
+        std::string timeout;
         for (const auto &token : tokens) {
             auto equal = token.find('=');
             if (equal == std::string::npos) {
@@ -506,109 +797,627 @@ void SkkEngine::loadDictionary() {
 
             if (key == "type") {
                 if (value == "file") {
-                    type = FcitxSkkDictType::FSDT_File;
+                    info.type = FcitxSkkDictType::FSDT_File;
                 } else if (value == "server") {
-                    type = FcitxSkkDictType::FSTD_Server;
+                    info.type = FcitxSkkDictType::FSTD_Server;
+                } else if (value == "mmap") {
+                    info.type = FcitxSkkDictType::FSDT_Mmap;
                 }
             } else if (key == "file") {
-                path = value;
+                info.path = value;
             } else if (key == "mode") {
                 if (value == "readonly") {
-                    mode = 1;
+                    info.mode = 1;
                 } else if (value == "readwrite") {
-                    mode = 2;
+                    info.mode = 2;
                 }
             } else if (key == "host") {
-                host = value;
+                address.host = value;
             } else if (key == "port") {
                 port = value;
+            } else if (key == "timeout") {
+                timeout = value;
+            } else if (key == "group") {
+                info.group = value;
             } else if (key == "encoding") {
-                encoding = value;
+                info.encoding = value;
             }
         }
 
-        encoding = !encoding.empty() ? encoding : "EUC-JP";
+        if (info.encoding.empty()) {
+            info.encoding = "EUC-JP";
+        }
 
-        if (type == FcitxSkkDictType::FSDT_Invalid) {
+        if (info.type == FcitxSkkDictType::FSDT_Invalid) {
             continue;
         }
-        if (type == FcitxSkkDictType::FSDT_File) {
-            if (path.empty() || mode == 0) {
+        if (info.type == FcitxSkkDictType::FSDT_Mmap) {
+            // Mmap dictionary is always readonly.
+            if (info.mode == 2) {
+                continue;
+            }
+            info.mode = 1;
+        }
+        if (info.type == FcitxSkkDictType::FSDT_File ||
+            info.type == FcitxSkkDictType::FSDT_Mmap) {
+            if (info.path.empty() || info.mode == 0) {
                 continue;
             }
 
-            std::string_view partialpath = path;
-            if (stringutils::consumePrefix(partialpath, "$FCITX_CONFIG_DIR/")) {
-                path = StandardPaths::global().userDirectory(
-                           StandardPathsType::PkgData) /
-                       partialpath;
-            } else if (stringutils::consumePrefix(partialpath,
-                                                  "$XDG_DATA_DIRS/")) {
-                path = StandardPaths::global().locate(StandardPathsType::Data,
-                                                      partialpath);
+            info.path = resolveDictionaryPath(info.path);
+        } else if (info.type == FcitxSkkDictType::FSTD_Server) {
+            if (address.host.empty()) {
+                address.host = "localhost";
+            }
+            if (port.empty()) {
+                port = "1178";
             }
 
-            if (mode == 1) {
-                if (path.ends_with(".cdb")) {
-                    SkkCdbDict *dict =
-                        skk_cdb_dict_new(path.data(), encoding.data(), nullptr);
-                    if (dict) {
-                        SKK_DEBUG() << "Adding cdb dict: " << path;
-                        dictionaries_.emplace_back(SKK_DICT(dict));
-                    }
-                } else {
-                    SkkFileDict *dict = skk_file_dict_new(
-                        path.data(), encoding.data(), nullptr);
-                    if (dict) {
-                        SKK_DEBUG() << "Adding file dict: " << path;
-                        dictionaries_.emplace_back(SKK_DICT(dict));
-                    }
+            try {
+                address.port = std::stoi(port);
+                if (address.port <= 0 || address.port > UINT16_MAX) {
+                    continue;
                 }
-            } else {
-                SkkUserDict *userdict =
-                    skk_user_dict_new(path.data(), encoding.data(), nullptr);
-                if (userdict) {
-                    SKK_DEBUG() << "Adding user dict: " << path;
-                    dictionaries_.emplace_back(SKK_DICT(userdict));
+            } catch (...) {
+                continue;
+            }
+
+            if (!timeout.empty()) {
+                try {
+                    info.timeout = std::max(std::stoi(timeout), 0);
+                } catch (...) {
                 }
             }
-        } else if (type == FcitxSkkDictType::FSTD_Server) {
-            host = !host.empty() ? host : "localhost";
-            port = !port.empty() ? port : "1178";
 
-            int iPort = 0;
-            try {
-                iPort = std::stoi(port);
-                if (iPort <= 0 || iPort > UINT16_MAX) {
+            // Servers in the same group serve the same dictionary, the
+            // later ones are used as fallback of the first. The timeout and
+            // encoding apply to the whole group, so a server that disagrees
+            // with the first one is left out.
+            if (!info.group.empty()) {
+                auto iter = std::find_if(
+                    infos.begin(), infos.end(), [&info](const auto &other) {
+                        return other.type == FcitxSkkDictType::FSTD_Server &&
+                               other.group == info.group;
+                    });
+                if (iter != infos.end()) {
+                    if (iter->timeout != info.timeout ||
+                        iter->encoding != info.encoding) {
+                        FCITX_LOGC(skk_logcategory, Warn)
+                            << "Ignore server " << address.host << ":"
+                            << address.port << " of group " << info.group
+                            << ", its timeout or encoding differs from the "
+                               "first server of the group.";
+                        continue;
+                    }
+                    iter->servers.push_back(std::move(address));
                     continue;
                 }
-            } catch (...) {
+            }
+            info.servers.push_back(std::move(address));
+        }
+        infos.push_back(std::move(info));
+    }
+    return infos;
+}
+
+// This is called from the dictionary loader thread, so it must not touch
+// the engine.
+GObjectUniquePtr<SkkDict> loadDictionary(const SkkDictionaryInfo &info) {
+    GObjectUniquePtr<SkkDict> result;
+    const auto &path = info.path;
+    const auto &encoding = info.encoding;
+    if (info.type == FcitxSkkDictType::FSDT_File) {
+        if (info.mode == 1) {
+            std::string cdbPath;
+            std::string cdbEncoding = encoding;
+            if (path.ends_with(".cdb")) {
+                cdbPath = path;
+            } else {
+                // Text dictionary is compiled into cdb once, which opens
+                // instantly and does not keep the whole file in memory. It
+                // is transcoded to UTF-8 at the same time.
+                cdbPath = compiledDictionary(path, encoding,
+                                             DictionaryCacheFormat::Cdb)
+                              .string();
+                cdbEncoding = "UTF-8";
+            }
+            if (!cdbPath.empty()) {
+                SkkCdbDict *dict = skk_cdb_dict_new(
+                    cdbPath.data(), cdbEncoding.data(), nullptr);
+                if (dict) {
+                    SKK_DEBUG() << "Adding cdb dict: " << cdbPath;
+                    result.reset(SKK_DICT(dict));
+                }
+            }
+            if (!result && !path.ends_with(".cdb")) {
+                SkkFileDict *dict =
+                    skk_file_dict_new(path.data(), encoding.data(), nullptr);
+                if (dict) {
+                    SKK_DEBUG() << "Adding file dict: " << path;
+                    result.reset(SKK_DICT(dict));
+                }
+            }
+        } else {
+            if (auto *userdict = newUserDict(path, encoding)) {
+                SKK_DEBUG() << "Adding user dict: " << path;
+                result.reset(userdict);
+            }
+        }
+    } else if (info.type == FcitxSkkDictType::FSDT_Mmap) {
+        std::string mmapPath;
+        std::string mmapEncoding = encoding;
+        if (path.ends_with(".skkmap")) {
+            mmapPath = path;
+        } else {
+            mmapPath = compiledDictionary(path, encoding,
+                                          DictionaryCacheFormat::Mmap)
+                           .string();
+            mmapEncoding = "UTF-8";
+        }
+        if (!mmapPath.empty()) {
+            if (auto *dict = newMmapDict(mmapPath, mmapEncoding)) {
+                SKK_DEBUG() << "Adding mmap dict: " << mmapPath;
+                result.reset(dict);
+            }
+        }
+    } else if (info.type == FcitxSkkDictType::FSTD_Server) {
+        for (const auto &server : info.servers) {
+            SKK_DEBUG() << "Adding server: " << server.host << ":"
+                        << server.port << " " << encoding
+                        << " timeout: " << info.timeout;
+        }
+        result.reset(newServerDict(info.servers, encoding, info.timeout));
+    }
+    return result;
+}
+
+GObjectUniquePtr<SkkDict> refDictionary(SkkDict *dict) {
+    return GObjectUniquePtr<SkkDict>{SKK_DICT(g_object_ref(dict))};
+}
+
+// Dictionaries do not depend on each other, so they are loaded in
+// parallel. Each result is stored in place to keep the configured order.
+void loadDictionaries(std::vector<SkkLoadedDictionary> &dictionaries) {
+    std::vector<SkkLoadedDictionary *> pending;
+    for (auto &dictionary : dictionaries) {
+        if (!dictionary.dict) {
+            pending.push_back(&dictionary);
+        } else {
+            SKK_DEBUG() << "Reuse dictionary: " << dictionary.key;
+        }
+    }
+
+    std::atomic<size_t> next = 0;
+    auto worker = [&pending, &next]() {
+        for (size_t i; (i = next++) < pending.size();) {
+            const auto &info = pending[i]->info;
+            SKK_TRACE1(load_dictionary_entry, info.path.data());
+            pending[i]->dict = loadDictionary(info);
+            SKK_TRACE2(load_dictionary_return, info.path.data(),
+                       pending[i]->dict != nullptr);
+        }
+    };
+    const size_t numThreads = std::min<size_t>(
+        pending.size(),
+        std::clamp(std::thread::hardware_concurrency(), 1U, maxLoaderThreads));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+std::vector<std::string>
+dictionaryKeys(const std::vector<SkkDictionaryInfo> &infos) {
+    std::vector<std::string> keys;
+    keys.reserve(infos.size());
+    for (const auto &info : infos) {
+        keys.push_back(info.cacheKey());
+    }
+    return keys;
+}
+
+} // namespace
+
+std::string SkkDictionaryInfo::cacheKey() const {
+    if (type == FcitxSkkDictType::FSTD_Server) {
+        std::string key = "server:";
+        for (const auto &server : servers) {
+            key = stringutils::concat(key, server.host, ":", server.port, ",");
+        }
+        return stringutils::concat(key, ":", encoding, ":", timeout);
+    }
+    auto key = stringutils::concat(
+        type == FcitxSkkDictType::FSDT_Mmap ? "mmap:" : "file:", mode, ":",
+        encoding, ":", path);
+    // A readwrite dictionary is written by ourselves, so its in-memory state
+    // is more up to date than the file.
+    if (mode == 1) {
+        struct stat st;
+        if (stat(path.data(), &st) == 0) {
+            key = stringutils::concat(key, ":", st.st_mtim.tv_sec, ".",
+                                      st.st_mtim.tv_nsec, ":", st.st_size);
+        }
+    }
+    return key;
+}
+
+std::vector<SkkLoadedDictionary>
+SkkEngine::prepareDictionaries(std::vector<SkkDictionaryInfo> infos) const {
+    std::vector<SkkLoadedDictionary> dictionaries;
+    dictionaries.reserve(infos.size());
+    for (auto &info : infos) {
+        auto &dictionary = dictionaries.emplace_back();
+        dictionary.key = info.cacheKey();
+        dictionary.info = std::move(info);
+        if (auto iter = dictionaryCache_.find(dictionary.key);
+            iter != dictionaryCache_.end()) {
+            dictionary.dict = refDictionary(iter->second.get());
+        }
+    }
+    return dictionaries;
+}
+
+void SkkEngine::loadDictionary() {
+    auto infos = readDictionaryList();
+    updateWatchedFiles(infos);
+    requestDictionaries(std::move(infos));
+}
+
+void SkkEngine::reloadDictionary() {
+    auto infos = readDictionaryList();
+    // Always, the list may be the same but the directories of its files
+    // may have been created or removed.
+    updateWatchedFiles(infos);
+    // Our own change of dictionary_list is noticed twice, through
+    // setSubConfig and the watcher, only the first one needs to load.
+    if (dictionaryKeys(infos) == requestedDictionaryKeys_) {
+        SKK_DEBUG() << "Dictionaries are unchanged.";
+        return;
+    }
+    requestDictionaries(std::move(infos));
+}
+
+void SkkEngine::requestDictionaries(std::vector<SkkDictionaryInfo> infos) {
+    requestedDictionaryKeys_ = dictionaryKeys(infos);
+
+    if (!*config_.loadDictionaryInBackground) {
+        // Discard the result of any loader that is still running.
+        ++dictionaryGeneration_;
+        pendingDictionaryInfos_.reset();
+        auto dictionaries = prepareDictionaries(std::move(infos));
+        loadDictionaries(dictionaries);
+        setDictionaries(std::move(dictionaries));
+        return;
+    }
+
+    if (dictionaryLoader_.joinable()) {
+        pendingDictionaryInfos_ = std::move(infos);
+        return;
+    }
+    startDictionaryLoader(std::move(infos));
+}
+
+void SkkEngine::startDictionaryLoader(std::vector<SkkDictionaryInfo> infos) {
+    const auto generation = ++dictionaryGeneration_;
+    // EventDispatcher only accepts copyable functions.
+    auto dictionaries = std::make_shared<std::vector<SkkLoadedDictionary>>(
+        prepareDictionaries(std::move(infos)));
+    dictionaryLoader_ = std::thread([this, generation, dictionaries]() {
+        loadDictionaries(*dictionaries);
+        dispatcher_.schedule([this, generation, dictionaries]() {
+            dictionaryLoaded(generation, std::move(*dictionaries));
+        });
+    });
+}
+
+void SkkEngine::dictionaryLoaded(
+    uint64_t generation, std::vector<SkkLoadedDictionary> dictionaries) {
+    dictionaryLoader_.join();
+    if (pendingDictionaryInfos_) {
+        // The result is outdated, but whatever has been loaded may still be
+        // picked up by the next loader.
+        for (auto &dictionary : dictionaries) {
+            if (dictionary.dict) {
+                dictionaryCache_.try_emplace(dictionary.key,
+                                             std::move(dictionary.dict));
+            }
+        }
+        auto infos = std::move(*pendingDictionaryInfos_);
+        pendingDictionaryInfos_.reset();
+        startDictionaryLoader(std::move(infos));
+        return;
+    }
+    if (generation != dictionaryGeneration_) {
+        return;
+    }
+    setDictionaries(std::move(dictionaries));
+}
+
+void SkkEngine::setDictionaries(std::vector<SkkLoadedDictionary> dictionaries) {
+    dictionaries_.clear();
+    // Only keep what is in use, so removed or modified entries are released.
+    dictionaryCache_.clear();
+    for (auto &dictionary : dictionaries) {
+        if (!dictionary.dict) {
+            // Try again on the next reload even if nothing changed.
+            requestedDictionaryKeys_.clear();
+            continue;
+        }
+        dictionaries_.push_back(refDictionary(dictionary.dict.get()));
+        dictionaryCache_.try_emplace(dictionary.key,
+                                     std::move(dictionary.dict));
+    }
+    SKK_DEBUG() << "Loaded " << dictionaries_.size() << " dictionaries.";
+    updateCachedDictionary();
+    updatePredictionSources(dictionaries);
+    applyDictionariesToStates();
+}
+
+void SkkEngine::applyDictionariesToStates() {
+    if (factory_.registered()) {
+        // This is not deferred like the config, otherwise an idle state
+        // keeps the old dictionaries alive.
+        instance_->inputContextManager().foreach([this](InputContext *ic) {
+            auto *state = this->state(ic);
+            if (state->hasContext()) {
+                state->applyDictionaries();
+            }
+            return true;
+        });
+    }
+    // Do not let idle contexts hold the old dictionaries.
+    for (const auto &context : contextPool_) {
+        applyDictionaries(context.get());
+    }
+}
+
+void SkkEngine::updateCachedDictionary() {
+    if (*config_.lookupCacheSize <= 0 || dictionaries_.empty()) {
+        cachedDictionary_.reset();
+        return;
+    }
+    std::vector<SkkDict *> dicts;
+    dicts.reserve(dictionaries_.size());
+    for (const auto &dict : dictionaries_) {
+        dicts.push_back(dict.get());
+    }
+    // Unchanged dictionaries are reused on reload, so the cached lookups
+    // usually survive it.
+    if (cachedDictionary_) {
+        updateCachedDict(cachedDictionary_.get(), dicts,
+                         *config_.lookupCacheSize);
+        return;
+    }
+    cachedDictionary_.reset(newCachedDict(dicts, *config_.lookupCacheSize));
+}
+
+void SkkEngine::updateWatchedFiles(
+    const std::vector<SkkDictionaryInfo> &infos) {
+    std::vector<std::string> files;
+    if (*config_.watchDictionaries) {
+        // Watch the user one even if it does not exist yet, since it takes
+        // precedence over the system one once created.
+        files.push_back((StandardPaths::global().userDirectory(
+                             StandardPathsType::PkgData) /
+                         "skk/dictionary_list")
+                            .string());
+        auto systemList = StandardPaths::global().locate(
+            StandardPathsType::PkgData, "skk/dictionary_list");
+        if (!systemList.empty()) {
+            files.push_back(systemList.string());
+        }
+        // Readwrite dictionaries are only written by ourselves, and servers
+        // have nothing to watch.
+        for (const auto &info : infos) {
+            if (info.mode == 1 && !info.path.empty()) {
+                files.push_back(info.path);
+            }
+        }
+    }
+    dictionaryWatcher_->setFiles(files);
+}
+
+void SkkEngine::updatePredictionSources(
+    const std::vector<SkkLoadedDictionary> &loaded) {
+    std::vector<PredictionSource> sources;
+    if (*config_.predictiveCompletion) {
+        for (const auto &dictionary : loaded) {
+            const auto &info = dictionary.info;
+            // Only text dictionaries can be compiled for the index. The
+            // readwrite ones are looked up directly by userPredictions().
+            if ((info.type != FcitxSkkDictType::FSDT_File &&
+                 info.type != FcitxSkkDictType::FSDT_Mmap) ||
+                info.mode != 1 || info.path.ends_with(".cdb") ||
+                info.path.ends_with(".skkmap")) {
                 continue;
             }
+            sources.push_back({info.path, info.encoding, dictionary.key});
+        }
+    }
+    predictor_.setSources(std::move(sources));
+}
 
-            SkkSkkServ *dict =
-                skk_skk_serv_new(host.data(), iPort, encoding.data(), nullptr);
-            if (dict) {
-                SKK_DEBUG() << "Adding server: " << host << ":" << iPort << " "
-                            << encoding;
-                dictionaries_.emplace_back(SKK_DICT(dict));
+std::vector<Prediction> SkkEngine::userPredictions(const std::string &prefix,
+                                                   size_t limit) const {
+    std::vector<std::pair<SkkDict *, std::string>> completions;
+    for (const auto &dict : dictionaries_) {
+        if (skk_dict_get_read_only(dict.get())) {
+            continue;
+        }
+        gint length = 0;
+        UniqueCPtr<gchar *, g_strfreev> strings{
+            skk_dict_complete(dict.get(), prefix.data(), &length)};
+        for (gint i = 0; i < length; i++) {
+            completions.emplace_back(dict.get(), strings.get()[i]);
+        }
+    }
+    // Same order as the prediction index, shorter readings first. Only the
+    // readings needed to fill limit are looked up, a short prefix may match
+    // most of the user dictionary.
+    std::stable_sort(completions.begin(), completions.end(),
+                     [](const auto &lhs, const auto &rhs) {
+                         return lhs.second.size() < rhs.second.size();
+                     });
+    std::vector<Prediction> result;
+    std::unordered_set<std::string> seen;
+    for (const auto &[dict, reading] : completions) {
+        if (result.size() >= limit) {
+            break;
+        }
+        gint size = 0;
+        SkkCandidate **candidates =
+            skk_dict_lookup(dict, reading.data(), false, &size);
+        for (gint j = 0; j < size; j++) {
+            const auto *text = skk_candidate_get_text(candidates[j]);
+            if (result.size() < limit && text[0] != '(' &&
+                seen.insert(text).second) {
+                result.push_back({reading, text});
             }
+            g_object_unref(candidates[j]);
         }
+        g_free(candidates);
     }
+    return result;
 }
 
-SkkEngine::~SkkEngine() {}
+void SkkEngine::learnPrediction(const Prediction &prediction) {
+    GObjectUniquePtr<SkkCandidate> candidate{
+        skk_candidate_new(prediction.reading.data(), false,
+                          prediction.text.data(), nullptr,
+                          prediction.text.data())};
+    // The cached dictionary passes it to the writable dictionaries and drops
+    // the cached result of the reading.
+    if (auto *cached = cachedDictionary()) {
+        skk_dict_select_candidate(cached, candidate.get());
+        return;
+    }
+    for (const auto &dict : dictionaries_) {
+        if (!skk_dict_get_read_only(dict.get())) {
+            skk_dict_select_candidate(dict.get(), candidate.get());
+        }
+    }
+}
+
+GObjectUniquePtr<SkkContext> SkkEngine::acquireContext() {
+    if ((contextPoolHits_ + contextPoolMisses_ + 1) % 100 == 0) {
+        logContextPoolStatistics();
+    }
+    if (!contextPool_.empty()) {
+        contextPoolHits_ += 1;
+        auto context = std::move(contextPool_.back());
+        contextPool_.pop_back();
+        return context;
+    }
+
+    contextPoolMisses_ += 1;
+    GObjectUniquePtr<SkkContext> context{skk_context_new(nullptr, 0)};
+    const char *AUTO_START_HENKAN_KEYWORDS[] = {
+        "を", "、", "。", "．", "，", "？", "」", "！", "；", "：",
+        ")",  ";",  ":",  "）", "”",  "】", "』", "》", "〉", "｝",
+        "］", "〕", "}",  "]",  "?",  ".",  ",",  "!"};
+
+    skk_context_set_auto_start_henkan_keywords(
+        context.get(), const_cast<gchar **>(AUTO_START_HENKAN_KEYWORDS),
+        G_N_ELEMENTS(AUTO_START_HENKAN_KEYWORDS));
+    configureContext(context.get());
+    return context;
+}
+
+void SkkEngine::releaseContext(GObjectUniquePtr<SkkContext> context) {
+    if (contextPool_.size() >= static_cast<size_t>(*config_.contextPoolSize)) {
+        return;
+    }
+    skk_context_reset(context.get());
+    contextPool_.push_back(std::move(context));
+}
+
+void SkkEngine::configureContext(SkkContext *context) {
+    applyOptions(context);
+    applyRule(context);
+    applyDictionaries(context);
+}
+
+void SkkEngine::applyOptions(SkkContext *context) {
+    SkkCandidateList *skkCandidates = skk_context_get_candidates(context);
+    skk_candidate_list_set_page_start(skkCandidates,
+                                      *config_.nTriggersToShowCandWin);
+    skk_candidate_list_set_page_size(skkCandidates, *config_.pageSize);
+    skk_context_set_period_style(context, *config_.punctuationStyle);
+    skk_context_set_egg_like_newline(context, *config_.eggLikeNewLine);
+}
+
+void SkkEngine::applyRule(SkkContext *context) {
+    skk_context_set_typing_rule(context, userRule());
+}
+
+void SkkEngine::applyDictionaries(SkkContext *context) {
+    if (auto *cached = cachedDictionary()) {
+        skk_context_set_dictionaries(context, &cached, 1);
+        return;
+    }
+    std::vector<SkkDict *> dicts;
+    dicts.reserve(dictionaries_.size());
+    for (const auto &dict : dictionaries_) {
+        dicts.push_back(dict.get());
+    }
+    skk_context_set_dictionaries(context, dicts.data(), dicts.size());
+}
+
+void SkkEngine::logContextPoolStatistics() const {
+    SKK_DEBUG() << "Context pool hits: " << contextPoolHits_
+                << " misses: " << contextPoolMisses_
+                << " size: " << contextPool_.size();
+}
+
+SkkEngine::~SkkEngine() {
+    // Destroy all SkkState while the pool is still alive.
+    factory_.unregister();
+    logContextPoolStatistics();
+    if (dictionaryLoader_.joinable()) {
+        dictionaryLoader_.join();
+    }
+    dispatcher_.detach();
+}
 
 /////////////////////////////////////////////////////////////////////////////////////
 /// SkkState
 
 SkkState::SkkState(SkkEngine *engine, InputContext *ic)
-    : engine_(engine), ic_(ic), context_(skk_context_new(nullptr, 0)) {
-    SkkContext *context = context_.get();
-    skk_context_set_period_style(context, *engine_->config().punctuationStyle);
-    skk_context_set_input_mode(context, *engine_->config().inputMode);
+    : engine_(engine), ic_(ic), lastMode_(*engine->config().inputMode) {}
+
+SkkState::~SkkState() {
+    // The callback of a pending query does not reach us once the input
+    // context is gone, but there is no reason to run it either.
+    engine_->predictor().cancel(this);
+    if (context_) {
+        g_signal_handlers_disconnect_by_data(context_.get(), this);
+        g_signal_handlers_disconnect_by_data(
+            skk_context_get_candidates(context_.get()), this);
+        engine_->releaseContext(std::move(context_));
+    }
+}
+
+SkkContext *SkkState::context() {
+    if (context_) {
+        const auto &generation = engine_->configGeneration();
+        if (configGeneration_.options != generation.options) {
+            engine_->applyOptions(context_.get());
+        }
+        if (configGeneration_.rule != generation.rule) {
+            engine_->applyRule(context_.get());
+        }
+        configGeneration_ = generation;
+        return context_.get();
+    }
 
-    lastMode_ = skk_context_get_input_mode(context);
+    context_ = engine_->acquireContext();
+    configGeneration_ = engine_->configGeneration();
+    SkkContext *context = context_.get();
+    skk_context_set_input_mode(context, lastMode_);
     g_signal_connect(context, "notify::input-mode",
                      G_CALLBACK(SkkState::input_mode_changed_cb), this);
     g_signal_connect(context, "notify::preedit",
@@ -617,25 +1426,44 @@ SkkState::SkkState(SkkEngine *engine, InputContext *ic)
                      G_CALLBACK(retrieve_surrounding_text_cb), this);
     g_signal_connect(context, "delete_surrounding_text",
                      G_CALLBACK(delete_surrounding_text_cb), this);
-    updateInputMode();
-
-    const char *AUTO_START_HENKAN_KEYWORDS[] = {
-        "を", "、", "。", "．", "，", "？", "」", "！", "；", "：",
-        ")",  ";",  ":",  "）", "”",  "】", "』", "》", "〉", "｝",
-        "］", "〕", "}",  "]",  "?",  ".",  ",",  "!"};
+    candidatePages_.clear();
+    g_signal_connect(skk_context_get_candidates(context), "populated",
+                     G_CALLBACK(candidates_populated_cb), this);
+    return context;
+}
 
-    skk_context_set_auto_start_henkan_keywords(
-        context, const_cast<gchar **>(AUTO_START_HENKAN_KEYWORDS),
-        G_N_ELEMENTS(AUTO_START_HENKAN_KEYWORDS));
+SkkInputMode SkkState::inputMode() const {
+    return context_ ? skk_context_get_input_mode(context_.get()) : lastMode_;
 }
 
-SkkState::~SkkState() {
-    g_signal_handlers_disconnect_by_data(context_.get(), this);
+void SkkState::setInputMode(SkkInputMode mode) {
+    if (context_) {
+        skk_context_set_input_mode(context_.get(), mode);
+        return;
+    }
+    lastMode_ = mode;
+    engine_->modeAction()->update(ic_);
 }
 
 void SkkState::keyEvent(KeyEvent &keyEvent) {
-    if (handleCandidate(keyEvent)) {
-        return;
+    // If the rule ignores key release, libskk gives the same answer to every
+    // release without changing any state, so there is no need to ask again.
+    if (keyEvent.isRelease()) {
+        if (auto filtered = engine_->releaseFiltered()) {
+            if (*filtered) {
+                keyEvent.filterAndAccept();
+            }
+            return;
+        }
+    }
+
+    auto *context = this->context();
+    {
+        ScopedKeyPhase phase(engine_->statistics(),
+                             SkkKeyPhase::HandleCandidate);
+        if (handleCandidate(keyEvent) || handlePrediction(keyEvent)) {
+            return;
+        }
     }
 
     uint32_t modifiers = static_cast<uint32_t>(keyEvent.rawKey().states() &
@@ -645,18 +1473,26 @@ void SkkState::keyEvent(KeyEvent &keyEvent) {
         modifiers |= SKK_MODIFIER_TYPE_RELEASE_MASK;
     }
 
-    GObjectUniquePtr<SkkKeyEvent> key{skk_key_event_new_from_x_keysym(
-        keyEvent.rawKey().sym(), static_cast<SkkModifierType>(modifiers),
-        nullptr)};
+    auto *key = engine_->skkKeyEvent(keyEvent.rawKey().sym(), modifiers);
     if (!key) {
         return;
     }
 
     modeChanged_ = false;
-    if (skk_context_process_key_event(context_.get(), key.get())) {
+    bool filtered;
+    {
+        ScopedKeyPhase phase(engine_->statistics(), SkkKeyPhase::ProcessKey);
+        filtered = skk_context_process_key_event(context, key);
+    }
+    engine_->releaseSkkKeyEvent(keyEvent.rawKey().sym(), modifiers);
+    if (filtered) {
         keyEvent.filterAndAccept();
     }
+    if (keyEvent.isRelease()) {
+        engine_->setReleaseFiltered(keyEvent.filtered());
+    }
 
+    updatePrediction();
     updateUI();
     if (modeChanged_) {
         ic_->updateProperty(&engine_->factory());
@@ -685,30 +1521,8 @@ bool SkkState::handleCandidate(KeyEvent &keyEvent) {
         skk_candidate_list_page_down(skkCandidates);
         keyEvent.filterAndAccept();
     } else {
-        KeyList selectionKeys;
-
-        std::array<KeySym, 10> syms = {
-            FcitxKey_1, FcitxKey_2, FcitxKey_3, FcitxKey_4, FcitxKey_5,
-            FcitxKey_6, FcitxKey_7, FcitxKey_8, FcitxKey_9, FcitxKey_0,
-        };
-        if (*config.candidateChooseKey == CandidateChooseKey::ABC) {
-            syms = {
-                FcitxKey_a, FcitxKey_b, FcitxKey_c, FcitxKey_d, FcitxKey_e,
-                FcitxKey_f, FcitxKey_g, FcitxKey_h, FcitxKey_i, FcitxKey_j,
-            };
-        } else if (*config.candidateChooseKey == CandidateChooseKey::Qwerty) {
-            syms = {
-                FcitxKey_a, FcitxKey_s,         FcitxKey_d, FcitxKey_f,
-                FcitxKey_g, FcitxKey_h,         FcitxKey_j, FcitxKey_k,
-                FcitxKey_l, FcitxKey_semicolon,
-            };
-        }
-
-        KeyStates states;
-        for (auto sym : syms) {
-            selectionKeys.emplace_back(sym, states);
-        }
-        if (auto idx = keyEvent.key().keyListIndex(selectionKeys); idx >= 0) {
+        if (auto idx = keyEvent.key().keyListIndex(engine_->selectionKeys());
+            idx >= 0) {
             skk_candidate_list_select_at(
                 skkCandidates,
                 idx % skk_candidate_list_get_page_size(skkCandidates));
@@ -722,21 +1536,194 @@ bool SkkState::handleCandidate(KeyEvent &keyEvent) {
     return keyEvent.filtered();
 }
 
-void SkkState::updateUI() {
-    auto &inputPanel = ic_->inputPanel();
-    auto *context = context_.get();
+bool SkkState::handlePrediction(KeyEvent &keyEvent) {
+    if (predictions_.empty() || keyEvent.isRelease()) {
+        return false;
+    }
+    auto &config = engine_->config();
+    const int size = predictions_.size();
+    if (keyEvent.key().checkKeyList(*config.cursorDownKey)) {
+        predictionCursor_ = (predictionCursor_ + 1) % size;
+    } else if (keyEvent.key().checkKeyList(*config.cursorUpKey)) {
+        predictionCursor_ =
+            predictionCursor_ <= 0 ? size - 1 : predictionCursor_ - 1;
+    } else if (predictionCursor_ >= 0 &&
+               keyEvent.key().check(FcitxKey_Return)) {
+        keyEvent.filterAndAccept();
+        selectPrediction(predictionCursor_);
+        return true;
+    } else {
+        return false;
+    }
+    keyEvent.filterAndAccept();
+    updateUI();
+    return true;
+}
 
-    SkkCandidateList *skkCandidates = skk_context_get_candidates(context);
+void SkkState::updatePrediction() {
+    std::string prefix;
+    if (*engine_->config().predictiveCompletion &&
+        skk_context_get_input_mode(context_.get()) ==
+            SKK_INPUT_MODE_HIRAGANA &&
+        !skk_candidate_list_get_page_visible(
+            skk_context_get_candidates(context_.get()))) {
+        prefix = predictionPrefix(preedit_.toString());
+    }
+    if (prefix == predictionPrefix_) {
+        return;
+    }
+    clearPrediction();
+    if (prefix.empty()) {
+        return;
+    }
+    predictionPrefix_ = prefix;
+    // The lookup happens on the predictor thread, the result is shown once
+    // it arrives if the reading is still the same.
+    engine_->predictor().query(
+        this, std::move(prefix), *engine_->config().pageSize,
+        [engine = engine_, ref = ic_->watch()](
+            const std::string &prefix, std::vector<Prediction> predictions) {
+            if (auto *ic = ref.get()) {
+                engine->state(ic)->setPredictions(prefix,
+                                                  std::move(predictions));
+            }
+        });
+}
 
-    std::unique_ptr<SkkFcitxCandidateList> candidateList;
-    if (skk_candidate_list_get_page_visible(skkCandidates)) {
-        candidateList = std::make_unique<SkkFcitxCandidateList>(engine_, ic_);
+void SkkState::clearPrediction() {
+    if (!predictionPrefix_.empty()) {
+        engine_->predictor().cancel(this);
+    }
+    predictionPrefix_.clear();
+    predictions_.clear();
+    predictionCursor_ = -1;
+}
+
+void SkkState::setPredictions(const std::string &prefix,
+                              std::vector<Prediction> predictions) {
+    if (prefix != predictionPrefix_) {
+        return;
+    }
+    // What is learned in the user dictionary, including the journal, comes
+    // first. The index only covers the readonly dictionaries.
+    const size_t limit = *engine_->config().pageSize;
+    predictions_ = engine_->userPredictions(prefix, limit);
+    for (auto &prediction : predictions) {
+        if (predictions_.size() >= limit) {
+            break;
+        }
+        if (std::none_of(predictions_.begin(), predictions_.end(),
+                         [&prediction](const Prediction &item) {
+                             return item.text == prediction.text;
+                         })) {
+            predictions_.push_back(std::move(prediction));
+        }
+    }
+    predictionCursor_ = -1;
+    updateUI();
+}
+
+void SkkState::selectPrediction(int idx) {
+    if (idx < 0 || static_cast<size_t>(idx) >= predictions_.size()) {
+        return;
+    }
+    auto prediction = std::move(predictions_[idx]);
+    clearPrediction();
+    skk_context_reset(context());
+    engine_->learnPrediction(prediction);
+    ic_->commitString(prediction.text);
+    updateUI();
+}
+
+std::unique_ptr<CandidateList> SkkState::predictionCandidateList() {
+    auto candidateList = std::make_unique<CommonCandidateList>();
+    // Digits are part of the reading, so predictions have no label and are
+    // chosen with the cursor keys and Return.
+    candidateList->setLabels(std::vector<std::string>(predictions_.size()));
+    candidateList->setPageSize(predictions_.size());
+    candidateList->setLayoutHint(*engine_->config().candidateLayout);
+    for (size_t i = 0; i < predictions_.size(); i++) {
+        candidateList->append<SkkPredictionCandidateWord>(
+            engine_, Text(predictions_[i].text),
+            Text(predictions_[i].reading), i);
     }
+    if (predictionCursor_ >= 0) {
+        candidateList->setGlobalCursorIndex(predictionCursor_);
+    }
+    return candidateList;
+}
 
-    if (auto str = UniqueCPtr<char, g_free>{skk_context_poll_output(context)}) {
+void SkkState::updateUI() {
+    // Text is committed right away so it is never reordered, and the
+    // preedit and panel follow it at once, so the client never shows the
+    // committed text twice. Other updates wait until all the events already
+    // queued, e.g. a burst of keys, are handled.
+    if (commitOutput()) {
+        flushUI();
+        return;
+    }
+    if (!uiUpdateEvent_) {
+        uiUpdateEvent_ = engine_->instance()->eventLoop().addDeferEvent(
+            [this](EventSource *) {
+                flushUI();
+                return true;
+            });
+    } else if (!uiUpdateEvent_->isEnabled()) {
+        uiUpdateEvent_->setOneShot();
+    }
+}
+
+bool SkkState::commitOutput() {
+    if (auto str = UniqueCPtr<char, g_free>{
+            skk_context_poll_output(context_.get())}) {
         if (str && str.get()[0]) {
             ic_->commitString(str.get());
+            return true;
+        }
+    }
+    return false;
+}
+
+void SkkState::flushUI() {
+    SKK_TRACE1(update_ui_entry, inputMode());
+    updateInputPanel();
+    SKK_TRACE1(update_ui_return, ic_->inputPanel().candidateList()
+                                     ? ic_->inputPanel().candidateList()->size()
+                                     : 0);
+}
+
+void SkkState::updateInputPanel() {
+    ScopedKeyPhase phase(engine_->statistics(), SkkKeyPhase::UpdateUI);
+    if (uiUpdateEvent_) {
+        uiUpdateEvent_->setEnabled(false);
+    }
+    commitOutput();
+    const bool modeChanged = uiModeChanged_;
+    uiModeChanged_ = false;
+
+    auto &inputPanel = ic_->inputPanel();
+    SkkCandidateList *skkCandidates =
+        skk_context_get_candidates(context_.get());
+
+    // The list to show, either one the panel already holds or a new one.
+    CandidateList *candidateList = nullptr;
+    SkkFcitxCandidateList *recycledCandidateList = nullptr;
+    std::unique_ptr<CandidateList> newCandidateList;
+    if (skk_candidate_list_get_page_visible(skkCandidates)) {
+        ScopedKeyPhase phase(engine_->statistics(),
+                             SkkKeyPhase::CandidateList);
+        if ((recycledCandidateList = shownSkkCandidateList())) {
+            recycledCandidateList->update();
+            candidateList = recycledCandidateList;
+        } else {
+            newCandidateList =
+                std::make_unique<SkkFcitxCandidateList>(engine_, ic_);
         }
+    } else if (!predictions_.empty()) {
+        newCandidateList = predictionCandidateList();
+    }
+    if (newCandidateList) {
+        candidateList = newCandidateList.get();
     }
 
     // Skk almost filter every key, which makes it calls updateUI on release.
@@ -749,8 +1736,10 @@ void SkkState::updateUI() {
     lastIsEmpty_ = newIsEmpty;
 
     // Ensure we are not composing any text.
-    if (modeChanged_ && newIsEmpty) {
+    if (modeChanged && newIsEmpty) {
         inputPanel.reset();
+        shownCandidateList_ = nullptr;
+        shownCandidateSignature_.clear();
         ic_->updatePreedit();
         engine_->instance()->showInputMethodInformation(ic_);
         ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
@@ -761,12 +1750,44 @@ void SkkState::updateUI() {
         return;
     }
 
-    inputPanel.reset();
+    // Compare with what the panel has now, so nothing is sent to the
+    // frontend or the user interface when nothing visible changed.
+    const bool clientPreedit =
+        ic_->capabilityFlags().test(CapabilityFlag::Preedit);
+    const bool preeditChanged = !isSameText(
+        clientPreedit ? inputPanel.clientPreedit() : inputPanel.preedit(),
+        preedit_);
+    candidateSignature_.clear();
     if (candidateList) {
-        inputPanel.setCandidateList(std::move(candidateList));
+        candidateListSignature(*candidateList, candidateSignature_);
+    }
+    const bool candidatesChanged =
+        inputPanel.candidateList().get() != shownCandidateList_ ||
+        candidateSignature_ != shownCandidateSignature_;
+    if (!preeditChanged && !candidatesChanged) {
+        return;
     }
 
-    if (ic_->capabilityFlags().test(CapabilityFlag::Preedit)) {
+    // Only the client preedit changed, e.g. typing a reading, there is no
+    // need to touch the panel.
+    if (clientPreedit && !candidatesChanged && inputPanel.auxUp().empty() &&
+        inputPanel.auxDown().empty()) {
+        inputPanel.setClientPreedit(preedit_);
+        ic_->updatePreedit();
+        return;
+    }
+
+    shownCandidateList_ = candidateList;
+    std::swap(shownCandidateSignature_, candidateSignature_);
+    // A recycled list stays in the panel, the preedit is set again below.
+    if (!recycledCandidateList) {
+        inputPanel.reset();
+        if (newCandidateList) {
+            inputPanel.setCandidateList(std::move(newCandidateList));
+        }
+    }
+
+    if (clientPreedit) {
         inputPanel.setClientPreedit(preedit_);
         ic_->updatePreedit();
     } else {
@@ -776,43 +1797,42 @@ void SkkState::updateUI() {
     ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
 }
 
-void SkkState::applyConfig() {
-    auto &config = engine_->config();
-    SkkCandidateList *skkCandidates = skk_context_get_candidates(context());
-    skk_candidate_list_set_page_start(skkCandidates,
-                                      *config.nTriggersToShowCandWin);
-    skk_candidate_list_set_page_size(skkCandidates, *config.pageSize);
-    skk_context_set_period_style(context(), *config.punctuationStyle);
-    skk_context_set_egg_like_newline(context(), *config.eggLikeNewLine);
-    skk_context_set_typing_rule(context(), engine_->userRule());
+SkkFcitxCandidateList *SkkState::shownSkkCandidateList() {
+    return dynamic_cast<SkkFcitxCandidateList *>(
+        ic_->inputPanel().candidateList().get());
+}
 
-    std::vector<SkkDict *> dicts;
-    dicts.reserve(engine_->dictionaries().size());
-    for (const auto &dict : engine_->dictionaries()) {
-        dicts.push_back(dict.get());
-    }
-    skk_context_set_dictionaries(context(), dicts.data(), dicts.size());
+void SkkState::applyDictionaries() {
+    engine_->applyDictionaries(context_.get());
 }
+
 void SkkState::copyTo(InputContextProperty *property) {
     auto *otherState = static_cast<SkkState *>(property);
-    skk_context_set_input_mode(otherState->context(),
-                               skk_context_get_input_mode(context()));
+    otherState->setInputMode(inputMode());
 }
 
 void SkkState::updateInputMode() {
     engine_->modeAction()->update(ic_);
-    auto newMode = skk_context_get_input_mode(context());
+    auto newMode = skk_context_get_input_mode(context_.get());
     if (lastMode_ != newMode) {
         lastMode_ = newMode;
         modeChanged_ = true;
+        uiModeChanged_ = true;
     }
 }
-void SkkState::updatePreedit() { preedit_ = skkContextGetPreedit(context()); }
+void SkkState::updatePreedit() {
+    skkContextGetPreedit(context_.get(), preedit_);
+}
 
 void SkkState::reset() {
+    if (!context_) {
+        return;
+    }
+    clearPrediction();
     skk_context_reset(context());
-    preedit_ = Text();
-    updateUI();
+    preedit_.clear();
+    // Not deferred, another input method may use the panel right after.
+    flushUI();
 }
 
 void SkkState::input_mode_changed_cb(GObject * /*unused*/,
@@ -825,6 +1845,11 @@ void SkkState::preedit_changed_cb(GObject * /*unused*/, GParamSpec * /*unused*/,
     skk->updatePreedit();
 }
 
+void SkkState::candidates_populated_cb(SkkCandidateList * /*unused*/,
+                                       SkkState *skk) {
+    skk->candidatePages_.clear();
+}
+
 gboolean SkkState::retrieve_surrounding_text_cb(GObject * /*unused*/,
                                                 gchar **text, guint *cursor_pos,
                                                 SkkState *skk) {
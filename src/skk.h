@@ -7,8 +7,12 @@
 #ifndef _FCITX_SKK_SKK_H_
 #define _FCITX_SKK_SKK_H_
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <fcitx-config/configuration.h>
 #include <fcitx-config/enum.h>
@@ -16,6 +20,8 @@
 #include <fcitx-config/option.h>
 #include <fcitx-config/rawconfig.h>
 #include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/eventdispatcher.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/key.h>
 #include <fcitx-utils/keysym.h>
@@ -35,6 +41,11 @@
 #include <glib-object.h>
 #include <glib.h>
 #include <libskk/libskk.h>
+#include "dictwatcher.h"
+#include "predictor.h"
+#include "servdict.h"
+#include "skk_public.h"
+#include "skkstats.h"
 
 namespace fcitx {
 
@@ -127,6 +138,23 @@ FCITX_CONFIGURATION(
         this, "NTriggersToShowCandWin",
         _("Number candidate of Triggers To Show Candidate Window"), 4,
         IntConstrain(0, 7)};
+    Option<bool> loadDictionaryInBackground{
+        this, "LoadDictionaryInBackground",
+        _("Load dictionaries in background"), true};
+    Option<int, IntConstrain> lookupCacheSize{
+        this, "LookupCacheSize",
+        _("Number of cached dictionary lookups (0 to disable)"), 1000,
+        IntConstrain(0, 100000)};
+    Option<int, IntConstrain> contextPoolSize{
+        this, "ContextPoolSize",
+        _("Number of idle input states kept for reuse (0 to disable)"), 16,
+        IntConstrain(0, 1000)};
+    Option<bool> watchDictionaries{
+        this, "WatchDictionaries",
+        _("Reload dictionaries when they are changed on disk"), true};
+    Option<bool> predictiveCompletion{
+        this, "PredictiveCompletion",
+        _("Show words starting with the reading while typing"), false};
     ExternalOption dictionary{this, "Dict", _("Dictionary"),
                               "fcitx://config/addon/skk/dictionary_list"};);
 
@@ -135,6 +163,42 @@ using GObjectUniquePtr = UniqueCPtr<T, g_object_unref>;
 
 class SkkState;
 
+enum class FcitxSkkDictType { FSDT_Invalid, FSDT_File, FSTD_Server, FSDT_Mmap };
+
+// A parsed line of dictionary_list.
+struct SkkDictionaryInfo {
+    FcitxSkkDictType type = FcitxSkkDictType::FSDT_Invalid;
+    // 1 for readonly, 2 for readwrite.
+    int mode = 0;
+    std::string path;
+    // Servers of a type=server entry. Entries with the same group= are
+    // merged into one, and the servers are tried in order.
+    std::vector<SkkServerAddress> servers;
+    std::string group;
+    // Milliseconds to wait for the server in each lookup. The server
+    // dictionary caps it to 1000, which is also used for 0.
+    int timeout = 30;
+    std::string encoding;
+
+    // Identifies the dictionary object built from this entry, so it can be
+    // reused as long as the entry and the underlying file do not change.
+    std::string cacheKey() const;
+};
+
+// Incremented when the corresponding part of the config changes, so SkkState
+// only reapplies what changed.
+struct SkkConfigGeneration {
+    // Options set on SkkContext and its candidate list.
+    uint64_t options = 0;
+    uint64_t rule = 0;
+};
+
+struct SkkLoadedDictionary {
+    SkkDictionaryInfo info;
+    std::string key;
+    GObjectUniquePtr<SkkDict> dict;
+};
+
 class SkkEngine final : public InputMethodEngineV2 {
 public:
     SkkEngine(Instance *instance);
@@ -160,37 +224,161 @@ public:
     auto &config() { return config_; }
     auto instance() { return instance_; }
     void setConfig(const RawConfig &config) override {
+        const auto oldConfig = config_;
         config_.load(config, true);
         safeSaveAsIni(config_, "conf/skk.conf");
-        reloadConfig();
+        applyConfigChanges(oldConfig);
     }
     void setSubConfig(const std::string &path,
                       const fcitx::RawConfig & /*unused*/) override {
         if (path == "dictionary_list") {
-            reloadConfig();
+            reloadDictionary();
         }
     }
 
     SkkState *state(InputContext *ic) { return ic->propertyFor(&factory_); }
 
     const auto &dictionaries() { return dictionaries_; }
+    SkkDict *cachedDictionary() { return cachedDictionary_.get(); }
+    Predictor &predictor() { return predictor_; }
+    // SkkState reapplies the part of the config whose generation differs
+    // from the one it has seen.
+    const SkkConfigGeneration &configGeneration() const {
+        return configGeneration_;
+    }
+
+    // Returns a SkkContext configured with the current config, from the pool
+    // if there is one.
+    GObjectUniquePtr<SkkContext> acquireContext();
+    // Resets the context and keeps it for the next acquireContext(), unless
+    // the pool is full.
+    void releaseContext(GObjectUniquePtr<SkkContext> context);
+    void configureContext(SkkContext *context);
+    void applyOptions(SkkContext *context);
+    void applyRule(SkkContext *context);
+    void applyDictionaries(SkkContext *context);
     auto modeAction() { return modeAction_.get(); }
+    // Keys to select a candidate in the current page, built from
+    // CandidateChooseKey.
+    const KeyList &selectionKeys() const { return selectionKeys_; }
+    // Returns a cached SkkKeyEvent for the key, so typing does not create a
+    // GObject per key. Returns nullptr if libskk does not know the key. It
+    // must be passed to releaseSkkKeyEvent once libskk has processed it.
+    SkkKeyEvent *skkKeyEvent(KeySym sym, uint32_t modifiers);
+    // Drops the event from the cache if libskk kept a reference to it or
+    // changed it, so a key event libskk may still use is never shared.
+    void releaseSkkKeyEvent(KeySym sym, uint32_t modifiers);
+    // Result of processing a key release with the current rule, known only
+    // if the rule ignores key release and one has been processed.
+    std::optional<bool> releaseFiltered() const { return releaseFiltered_; }
+    void setReleaseFiltered(bool filtered) {
+        if (ruleIgnoresRelease_) {
+            releaseFiltered_ = filtered;
+        }
+    }
+    // Predictions from the readwrite dictionaries, which are not in the
+    // prediction index since they change while typing.
+    std::vector<Prediction> userPredictions(const std::string &prefix,
+                                            size_t limit) const;
+    // Learn a chosen prediction like a converted candidate.
+    void learnPrediction(const Prediction &prediction);
     auto userRule() { return userRule_.get(); }
+    SkkKeyStatistics &statistics() { return statistics_; }
+
+    std::string keyStatistics() const { return statistics_.toString(); }
+    void resetKeyStatistics() { statistics_.reset(); }
 
 private:
+    void applyConfigChanges(const SkkConfig &oldConfig);
+    void applyDictionariesToStates();
+    void updateSelectionKeys();
     void loadRule();
     void loadDictionary();
+    // Same as loadDictionary, but does nothing if the dictionaries to load
+    // are the same as the last ones.
+    void reloadDictionary();
+    void requestDictionaries(std::vector<SkkDictionaryInfo> infos);
+    std::vector<SkkLoadedDictionary>
+    prepareDictionaries(std::vector<SkkDictionaryInfo> infos) const;
+    void startDictionaryLoader(std::vector<SkkDictionaryInfo> infos);
+    void dictionaryLoaded(uint64_t generation,
+                          std::vector<SkkLoadedDictionary> dictionaries);
+    void setDictionaries(std::vector<SkkLoadedDictionary> dictionaries);
+    void updateCachedDictionary();
+    void logContextPoolStatistics() const;
+    void updateWatchedFiles(const std::vector<SkkDictionaryInfo> &infos);
+    void
+    updatePredictionSources(const std::vector<SkkLoadedDictionary> &loaded);
 
     Instance *instance_;
     FactoryFor<SkkState> factory_;
     SkkConfig config_;
+    EventDispatcher dispatcher_;
+    // Only one loader runs at a time, a reload request that arrives while it
+    // is busy is kept in pendingDictionaryInfos_.
+    std::thread dictionaryLoader_;
+    uint64_t dictionaryGeneration_ = 0;
+    std::optional<std::vector<SkkDictionaryInfo>> pendingDictionaryInfos_;
+    // SkkDictionaryInfo::cacheKey() of the last requested dictionaries.
+    std::vector<std::string> requestedDictionaryKeys_;
     std::vector<GObjectUniquePtr<SkkDict>> dictionaries_;
+    // Loaded dictionaries indexed by SkkDictionaryInfo::cacheKey().
+    std::unordered_map<std::string, GObjectUniquePtr<SkkDict>>
+        dictionaryCache_;
+    // Wraps dictionaries_ with a lookup cache shared by all input contexts,
+    // null if the cache is disabled.
+    GObjectUniquePtr<SkkDict> cachedDictionary_;
     std::vector<GObjectUniquePtr<SkkDict>> dummyEmptyDictionaries_;
+    // Idle contexts released by destroyed SkkState, they are kept configured
+    // so a new input context does not need to build one from scratch.
+    std::vector<GObjectUniquePtr<SkkContext>> contextPool_;
+    SkkConfigGeneration configGeneration_;
+    uint64_t contextPoolHits_ = 0;
+    uint64_t contextPoolMisses_ = 0;
+    // Reloads the dictionaries when dictionary_list or a readonly
+    // dictionary is modified.
+    std::unique_ptr<DictionaryWatcher> dictionaryWatcher_;
+    Predictor predictor_{&dispatcher_};
     GObjectUniquePtr<SkkRule> userRule_;
+    bool ruleIgnoresRelease_ = false;
+    std::optional<bool> releaseFiltered_;
+    KeyList selectionKeys_;
+    struct CachedKeyEvent {
+        GObjectUniquePtr<SkkKeyEvent> event;
+        SkkModifierType modifiers;
+        gunichar code;
+        const gchar *name;
+    };
+    std::unordered_map<uint64_t, CachedKeyEvent> keyEventCache_;
+    SkkKeyStatistics statistics_;
 
     std::unique_ptr<Action> modeAction_;
     std::unique_ptr<Menu> menu_;
     std::vector<std::unique_ptr<Action>> subModeActions_;
+
+    FCITX_ADDON_EXPORT_FUNCTION(SkkEngine, keyStatistics);
+    FCITX_ADDON_EXPORT_FUNCTION(SkkEngine, resetKeyStatistics);
+};
+
+struct SkkCandidatePage;
+class SkkFcitxCandidateList;
+
+// Pages of the current libskk candidate list built so far, so moving the
+// cursor or paging back and forth does not convert the candidates again.
+// It must be cleared whenever libskk populates the list again.
+class SkkCandidatePageCache {
+public:
+    std::shared_ptr<const SkkCandidatePage>
+    page(SkkEngine *engine, SkkCandidateList *candidates, int index);
+    void clear() { pages_.clear(); }
+
+private:
+    std::unordered_map<int, std::shared_ptr<const SkkCandidatePage>> pages_;
+    gint size_ = 0;
+    guint pageStart_ = 0;
+    guint pageSize_ = 0;
+    bool showAnnotation_ = false;
+    CandidateChooseKey chooseKey_ = CandidateChooseKey::Digit;
 };
 
 class SkkAddonFactory final : public AddonFactory {
@@ -207,23 +395,48 @@ public:
     ~SkkState();
 
     void keyEvent(KeyEvent &keyEvent);
+    // Commit the output of libskk and update the input panel, right away if
+    // anything is committed, or else on the event loop.
     void updateUI();
-    SkkContext *context() { return context_.get(); }
-    void applyConfig();
+    // Update the input panel now.
+    void flushUI();
+    // The SkkContext is only created on first use, since most input contexts
+    // never use skk. Config changes made since the last use are applied
+    // here as well.
+    SkkContext *context();
+    bool hasContext() const { return context_ != nullptr; }
+    SkkInputMode inputMode() const;
+    void setInputMode(SkkInputMode mode);
+    void applyDictionaries();
     bool needCopy() const override { return true; }
     void copyTo(InputContextProperty *property) override;
     void reset();
+    void setPredictions(const std::string &prefix,
+                        std::vector<Prediction> predictions);
+    void selectPrediction(int idx);
+    SkkCandidatePageCache &candidatePages() { return candidatePages_; }
 
 private:
     bool handleCandidate(KeyEvent &keyEvent);
+    bool handlePrediction(KeyEvent &keyEvent);
+    void updatePrediction();
+    void clearPrediction();
+    std::unique_ptr<CandidateList> predictionCandidateList();
     void updateInputMode();
     void updatePreedit();
+    // Returns whether anything is committed.
+    bool commitOutput();
+    void updateInputPanel();
+    // The list of libskk candidates the input panel holds, if any.
+    SkkFcitxCandidateList *shownSkkCandidateList();
 
     // callbacks and their handlers
     static void input_mode_changed_cb(GObject *gobject, GParamSpec *pspec,
                                       SkkState *skk);
     static void preedit_changed_cb(GObject *gobject, GParamSpec *pspec,
                                    SkkState *skk);
+    static void candidates_populated_cb(SkkCandidateList *candidates,
+                                        SkkState *skk);
     static gboolean retrieve_surrounding_text_cb(GObject *, gchar **text,
                                                  guint *cursor_pos,
                                                  SkkState *skk);
@@ -233,10 +446,26 @@ private:
     SkkEngine *engine_;
     InputContext *ic_;
     GObjectUniquePtr<SkkContext> context_;
+    SkkConfigGeneration configGeneration_;
     bool modeChanged_ = false;
+    // Mode changed since the input panel was last updated.
+    bool uiModeChanged_ = false;
     SkkInputMode lastMode_ = SKK_INPUT_MODE_DEFAULT;
     bool lastIsEmpty_ = true;
     Text preedit_;
+    // The candidate list last set to the input panel, used to tell whether
+    // it needs to be replaced. A list of libskk candidates the panel still
+    // holds is updated in place instead.
+    const CandidateList *shownCandidateList_ = nullptr;
+    std::string shownCandidateSignature_;
+    // Reused to build the signature of the next update.
+    std::string candidateSignature_;
+    SkkCandidatePageCache candidatePages_;
+    std::unique_ptr<EventSource> uiUpdateEvent_;
+    // Reading the predictions are requested for, empty if there is none.
+    std::string predictionPrefix_;
+    std::vector<Prediction> predictions_;
+    int predictionCursor_ = -1;
 };
 
 } // namespace fcitx
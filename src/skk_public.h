@@ -0,0 +1,18 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_SKK_PUBLIC_H_
+#define _FCITX_SKK_SKK_PUBLIC_H_
+
+#include <string>
+#include <fcitx/addoninstance.h>
+
+// Latency of key events handled by skk since startup or the last reset,
+// split by phase, as human readable text.
+FCITX_ADDON_DECLARE_FUNCTION(SkkEngine, keyStatistics, std::string());
+FCITX_ADDON_DECLARE_FUNCTION(SkkEngine, resetKeyStatistics, void());
+
+#endif // _FCITX_SKK_SKK_PUBLIC_H_
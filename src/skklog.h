@@ -0,0 +1,18 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_SKKLOG_H_
+#define _FCITX_SKK_SKKLOG_H_
+
+#include <fcitx-utils/log.h>
+
+namespace fcitx {
+FCITX_DECLARE_LOG_CATEGORY(skk_logcategory);
+} // namespace fcitx
+
+#define SKK_DEBUG() FCITX_LOGC(::fcitx::skk_logcategory, Debug)
+
+#endif // _FCITX_SKK_SKKLOG_H_
@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "skkstats.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <fcitx-utils/stringutils.h>
+
+namespace fcitx {
+
+namespace {
+
+constexpr const char *phaseNames[numKeyPhases] = {
+    "total", "handleCandidate", "processKey", "candidateList", "updateUI",
+};
+
+} // namespace
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+    const uint64_t microseconds = nanoseconds / 1000;
+    const size_t bucket =
+        std::min<size_t>(std::bit_width(microseconds), numBuckets - 1);
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(nanoseconds, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (nanoseconds > max &&
+           !max_.compare_exchange_weak(max, nanoseconds,
+                                       std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (auto &bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    total_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    const auto total = count();
+    const auto target = static_cast<uint64_t>(fraction * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < numBuckets; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen > target || seen == total) {
+            return uint64_t(1) << i;
+        }
+    }
+    return uint64_t(1) << (numBuckets - 1);
+}
+
+std::string LatencyHistogram::toString() const {
+    const auto total = count();
+    if (!total) {
+        return "no events";
+    }
+    std::string result = stringutils::concat(
+        "count=", total,
+        " mean=", total_.load(std::memory_order_relaxed) / total / 1000,
+        "us p50<", percentile(0.5), "us p90<", percentile(0.9),
+        "us p99<", percentile(0.99),
+        "us max=", max_.load(std::memory_order_relaxed) / 1000, "us [");
+    // Only the non-empty buckets, as "upper bound:count".
+    bool first = true;
+    for (size_t i = 0; i < numBuckets; i++) {
+        const auto value = buckets_[i].load(std::memory_order_relaxed);
+        if (!value) {
+            continue;
+        }
+        if (!first) {
+            result.push_back(' ');
+        }
+        first = false;
+        result.append(
+            i + 1 == numBuckets
+                ? stringutils::concat(">=", uint64_t(1) << (i - 1), ":", value)
+                : stringutils::concat("<", uint64_t(1) << i, ":", value));
+    }
+    result.push_back(']');
+    return result;
+}
+
+void SkkKeyStatistics::reset() {
+    for (auto &phase : phases_) {
+        phase.reset();
+    }
+    filtered_.store(0, std::memory_order_relaxed);
+    unfiltered_.store(0, std::memory_order_relaxed);
+}
+
+std::string SkkKeyStatistics::toString() const {
+    std::string result = stringutils::concat(
+        "key events: filtered=", filtered_.load(std::memory_order_relaxed),
+        " unfiltered=", unfiltered_.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < numKeyPhases; i++) {
+        result.append(
+            stringutils::concat("\n", phaseNames[i], ": ",
+                                phases_[i].toString()));
+    }
+    return result;
+}
+
+} // namespace fcitx
@@ -0,0 +1,100 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_SKKSTATS_H_
+#define _FCITX_SKK_SKKSTATS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace fcitx {
+
+// Latency of key events in power of two buckets of microseconds. Bucket 0
+// counts events shorter than 1us, bucket i those in [2^(i-1), 2^i) us, and
+// the last one everything longer.
+class LatencyHistogram {
+public:
+    static constexpr size_t numBuckets = 24;
+
+    void record(uint64_t nanoseconds);
+    void reset();
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    // Returns the upper bound of the bucket holding the given fraction of
+    // events, in microseconds.
+    uint64_t percentile(double fraction) const;
+    std::string toString() const;
+
+private:
+    std::array<std::atomic<uint64_t>, numBuckets> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+enum class SkkKeyPhase {
+    // The whole SkkState::keyEvent.
+    Total,
+    // Candidate and prediction keys handled by fcitx-skk itself.
+    HandleCandidate,
+    ProcessKey,
+    CandidateList,
+    // The input panel update, which is deferred from the key event.
+    UpdateUI,
+};
+
+inline constexpr size_t numKeyPhases = 5;
+
+class SkkKeyStatistics {
+public:
+    void record(SkkKeyPhase phase, uint64_t nanoseconds) {
+        phases_[static_cast<size_t>(phase)].record(nanoseconds);
+    }
+    void countFiltered(bool filtered) {
+        (filtered ? filtered_ : unfiltered_)
+            .fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t keyEvents() const {
+        return phases_[static_cast<size_t>(SkkKeyPhase::Total)].count();
+    }
+    void reset();
+    std::string toString() const;
+
+private:
+    std::array<LatencyHistogram, numKeyPhases> phases_;
+    std::atomic<uint64_t> filtered_{0};
+    std::atomic<uint64_t> unfiltered_{0};
+};
+
+// Records the time from construction to destruction into a phase.
+class ScopedKeyPhase {
+public:
+    ScopedKeyPhase(SkkKeyStatistics &statistics, SkkKeyPhase phase)
+        : statistics_(statistics), phase_(phase),
+          start_(std::chrono::steady_clock::now()) {}
+    ~ScopedKeyPhase() {
+        statistics_.record(
+            phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_)
+                        .count());
+    }
+
+    ScopedKeyPhase(const ScopedKeyPhase &) = delete;
+    ScopedKeyPhase &operator=(const ScopedKeyPhase &) = delete;
+
+private:
+    SkkKeyStatistics &statistics_;
+    SkkKeyPhase phase_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_SKKSTATS_H_
@@ -0,0 +1,31 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_SKKTRACE_H_
+#define _FCITX_SKK_SKKTRACE_H_
+
+#include "config.h"
+
+// Static tracepoints of the fcitx5_skk provider, for perf, bpftrace or
+// systemtap, e.g.
+//   bpftrace -e 'usdt:/usr/lib/fcitx5/skk.so:fcitx5_skk:key_event_entry
+//                { printf("%x\n", arg0); }'
+// Arguments are only evaluated when the tracepoints are built.
+#ifdef ENABLE_TRACEPOINTS
+#include <sys/sdt.h>
+#define SKK_TRACE(NAME) DTRACE_PROBE(fcitx5_skk, NAME)
+#define SKK_TRACE1(NAME, ARG1) DTRACE_PROBE1(fcitx5_skk, NAME, ARG1)
+#define SKK_TRACE2(NAME, ARG1, ARG2)                                           \
+    DTRACE_PROBE2(fcitx5_skk, NAME, ARG1, ARG2)
+#else
+#define SKK_TRACE(NAME)                                                        \
+    do {                                                                       \
+    } while (0)
+#define SKK_TRACE1(NAME, ARG1) SKK_TRACE(NAME)
+#define SKK_TRACE2(NAME, ARG1, ARG2) SKK_TRACE(NAME)
+#endif
+
+#endif // _FCITX_SKK_SKKTRACE_H_
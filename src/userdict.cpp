@@ -0,0 +1,687 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#include "userdict.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <fcitx-utils/fs.h>
+#include <fcitx-utils/standardpaths.h>
+#include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/unixfd.h>
+#include <glib-object.h>
+#include <glib.h>
+#include <libskk/libskk.h>
+#include "dictcache.h"
+#include "dictutils.h"
+#include "skklog.h"
+
+namespace fcitx {
+
+namespace {
+
+// Comment in the dictionary file that tells which journal belongs to it.
+constexpr std::string_view generationMarker = ";; fcitx5-skk generation ";
+constexpr std::string_view journalHeader = "generation ";
+constexpr std::string_view concatPrefix = "(concat \"";
+constexpr std::string_view concatSuffix = "\")";
+
+struct UserCandidate {
+    std::string text;
+    std::string annotation;
+};
+
+struct UserEntry {
+    std::vector<UserCandidate> candidates;
+    // Okuri blocks of an okuri-ari entry, e.g. "[く/送/]/", written back as
+    // they were read.
+    std::string okuriBlocks;
+};
+
+using UserEntries = std::map<std::string, UserEntry>;
+
+// What the dictionary file holds, the journal is applied on top of it.
+struct UserDictionaryFile {
+    UserEntries okuriAri;
+    UserEntries okuriNasi;
+    // Comments and other lines that are not entries, written back before
+    // the entries.
+    std::vector<std::string> otherLines;
+    uint64_t generation = 0;
+};
+
+// Journal fields are separated by tab, escape them in the data.
+std::string escape(std::string_view data) {
+    std::string result;
+    for (char c : data) {
+        switch (c) {
+        case '\\':
+            result.append("\\\\");
+            break;
+        case '\t':
+            result.append("\\t");
+            break;
+        case '\n':
+            result.append("\\n");
+            break;
+        default:
+            result.push_back(c);
+        }
+    }
+    return result;
+}
+
+std::string unescape(std::string_view data) {
+    std::string result;
+    for (size_t i = 0; i < data.size(); i++) {
+        if (data[i] != '\\' || i + 1 == data.size()) {
+            result.push_back(data[i]);
+            continue;
+        }
+        i++;
+        switch (data[i]) {
+        case 't':
+            result.push_back('\t');
+            break;
+        case 'n':
+            result.push_back('\n');
+            break;
+        default:
+            result.push_back(data[i]);
+        }
+    }
+    return result;
+}
+
+// "/" and ";" separate candidates and annotations in the dictionary file,
+// like libskk a text that contains them is written as (concat "a\057b").
+std::string quoteCandidate(const std::string &text) {
+    if (text.find_first_of("/;") == std::string::npos) {
+        return text;
+    }
+    std::string result(concatPrefix);
+    for (char c : text) {
+        switch (c) {
+        case '/':
+            result.append("\\057");
+            break;
+        case ';':
+            result.append("\\073");
+            break;
+        case '"':
+        case '\\':
+            result.push_back('\\');
+            result.push_back(c);
+            break;
+        default:
+            result.push_back(c);
+        }
+    }
+    result.append(concatSuffix);
+    return result;
+}
+
+// Reverse of quoteCandidate. Anything but a single string literal in concat
+// is an expression for libskk and is kept as is.
+std::string unquoteCandidate(std::string_view text) {
+    if (!text.starts_with(concatPrefix) || !text.ends_with(concatSuffix)) {
+        return std::string(text);
+    }
+    auto literal = text.substr(concatPrefix.size(),
+                               text.size() - concatPrefix.size() -
+                                   concatSuffix.size());
+    std::string result;
+    for (size_t i = 0; i < literal.size(); i++) {
+        if (literal[i] == '"') {
+            return std::string(text);
+        }
+        if (literal[i] != '\\') {
+            result.push_back(literal[i]);
+            continue;
+        }
+        if (++i == literal.size()) {
+            return std::string(text);
+        }
+        if (literal[i] < '0' || literal[i] > '7') {
+            result.push_back(literal[i]);
+            continue;
+        }
+        int value = 0;
+        for (size_t digits = 0; digits < 3 && i < literal.size() &&
+                                literal[i] >= '0' && literal[i] <= '7';
+             digits++, i++) {
+            value = value * 8 + (literal[i] - '0');
+        }
+        i--;
+        result.push_back(static_cast<char>(value));
+    }
+    return result;
+}
+
+// Flush the directory entry of a file created by rename.
+void syncParentDirectory(const std::string &path) {
+    auto parent = std::filesystem::path(path).parent_path();
+    UnixFD dir = UnixFD::own(::open(parent.empty() ? "." : parent.c_str(),
+                                    O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (dir.isValid()) {
+        ::fsync(dir.fd());
+    }
+}
+
+std::optional<std::string> readFile(const std::string &path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in) {
+        return std::nullopt;
+    }
+    std::string content{std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>()};
+    if (in.bad()) {
+        return std::nullopt;
+    }
+    return content;
+}
+
+// The okuri blocks of the candidate part of a line, see UserEntry.
+std::string okuriBlocks(std::string_view line) {
+    std::string result;
+    bool inOkuriBlock = false;
+    while (!line.empty()) {
+        auto end = line.find('/');
+        auto item = line.substr(0, end);
+        line.remove_prefix(end == std::string_view::npos ? line.size()
+                                                         : end + 1);
+        if (!inOkuriBlock && !item.starts_with('[')) {
+            continue;
+        }
+        inOkuriBlock = item != "]";
+        result.append(item);
+        result.push_back('/');
+    }
+    return result;
+}
+
+template <typename Callback>
+void forEachLine(std::string_view content, Callback callback) {
+    while (!content.empty()) {
+        auto end = content.find('\n');
+        auto line = content.substr(0, end);
+        content.remove_prefix(end == std::string_view::npos ? content.size()
+                                                            : end + 1);
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+        callback(line);
+    }
+}
+
+class UserDictionary {
+public:
+    UserDictionary(std::string path, std::string encoding)
+        : path_(std::move(path)), encoding_(std::move(encoding)),
+          journalPath_(stringutils::concat(path_, ".journal")) {}
+
+    // The current entries and journal are only replaced once the file is
+    // read, so a failed reload keeps them and save() does not overwrite the
+    // file with an empty dictionary.
+    bool load(GError **error) {
+        UserDictionaryFile file;
+        std::error_code ec;
+        if (std::filesystem::exists(path_, ec)) {
+            auto content = readFile(path_);
+            if (!content) {
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                            "Failed to read %s", path_.data());
+                return false;
+            }
+            auto decoded =
+                convertEncoding(*content, "UTF-8", encoding_.data());
+            if (!decoded) {
+                decoded = decodeLines(*content);
+            }
+            parse(*decoded, file);
+        }
+
+        okuriAri_ = std::move(file.okuriAri);
+        okuriNasi_ = std::move(file.okuriNasi);
+        otherLines_ = std::move(file.otherLines);
+        generation_ = file.generation;
+        journalRecords_ = 0;
+        journal_.reset();
+
+        bool journalValid = false;
+        if (auto journal = readFile(journalPath_)) {
+            journalValid = replay(*journal);
+        }
+        if (!openJournal(!journalValid)) {
+            SKK_DEBUG() << "Failed to open journal " << journalPath_;
+        }
+        if (journalRecords_ > 0) {
+            SKK_DEBUG() << "Replayed " << journalRecords_
+                        << " journal records of " << path_;
+        }
+        return true;
+    }
+
+    const std::vector<UserCandidate> *find(const std::string &midasi,
+                                           bool okuri) const {
+        const auto &entries = okuri ? okuriAri_ : okuriNasi_;
+        auto iter = entries.find(midasi);
+        return iter == entries.end() ? nullptr : &iter->second.candidates;
+    }
+
+    // Okuri-nasi midasi that start with prefix.
+    std::vector<std::string> complete(const std::string &prefix) const {
+        std::vector<std::string> result;
+        for (auto iter = okuriNasi_.lower_bound(prefix);
+             iter != okuriNasi_.end() && iter->first.starts_with(prefix);
+             ++iter) {
+            if (iter->first != prefix) {
+                result.push_back(iter->first);
+            }
+        }
+        return result;
+    }
+
+    bool select(const std::string &midasi, bool okuri,
+                UserCandidate candidate) {
+        const auto record = stringutils::concat(
+            "S\t", okuri ? "1" : "0", "\t", escape(midasi), "\t",
+            escape(candidate.text), "\t", escape(candidate.annotation), "\n");
+        if (!applySelect(midasi, okuri, std::move(candidate))) {
+            return false;
+        }
+        appendJournal(record);
+        return true;
+    }
+
+    bool purge(const std::string &midasi, bool okuri,
+               const std::string &text) {
+        if (!applyPurge(midasi, okuri, text)) {
+            return false;
+        }
+        appendJournal(stringutils::concat("P\t", okuri ? "1" : "0", "\t",
+                                          escape(midasi), "\t", escape(text),
+                                          "\t\n"));
+        return true;
+    }
+
+    // Write all entries to the file and start a new journal. This is the
+    // only place the journal is merged into the file.
+    bool save() {
+        if (journalRecords_ == 0 && journal_.isValid()) {
+            return true;
+        }
+        const auto generation = generation_ + 1;
+        auto content = serialize(generation);
+        if (!StandardPaths::global().safeSave(
+                StandardPathsType::PkgData, path_, [&content](int fd) {
+                    return fs::safeWrite(fd, content.data(), content.size()) ==
+                               static_cast<ssize_t>(content.size()) &&
+                           ::fsync(fd) == 0;
+                })) {
+            SKK_DEBUG() << "Failed to save user dictionary " << path_;
+            return false;
+        }
+        syncParentDirectory(path_);
+        generation_ = generation;
+        // The file of the new generation is on disk before the journal is
+        // reset. A crash in between leaves a journal of the old generation,
+        // which is ignored by load().
+        if (!openJournal(true)) {
+            SKK_DEBUG() << "Failed to open journal " << journalPath_;
+        }
+        SKK_DEBUG() << "Saved user dictionary " << path_;
+        return true;
+    }
+
+private:
+    // Only the lines that can not be converted are dropped, instead of the
+    // whole file.
+    std::string decodeLines(std::string_view content) const {
+        std::string result;
+        forEachLine(content, [this, &result](std::string_view line) {
+            if (auto decoded =
+                    convertEncoding(line, "UTF-8", encoding_.data())) {
+                result.append(*decoded);
+                result.push_back('\n');
+            } else {
+                FCITX_LOGC(skk_logcategory, Warn)
+                    << "Drop line of " << path_
+                    << " that can not be converted from " << encoding_;
+            }
+        });
+        return result;
+    }
+
+    static void parse(std::string_view content, UserDictionaryFile &file) {
+        std::optional<bool> okuri;
+        forEachLine(content, [&file, &okuri](std::string_view line) {
+            if (line.starts_with(okuriAriMarker)) {
+                okuri = true;
+                return;
+            }
+            if (line.starts_with(okuriNasiMarker)) {
+                okuri = false;
+                return;
+            }
+            if (stringutils::consumePrefix(line, generationMarker)) {
+                file.generation = std::strtoull(std::string(line).data(),
+                                            nullptr, 10);
+                return;
+            }
+            if (line.empty()) {
+                return;
+            }
+            auto space = line.find(" /");
+            if (line.front() == ';' || !okuri ||
+                space == std::string_view::npos || space == 0) {
+                file.otherLines.emplace_back(line);
+                return;
+            }
+            auto &entry =
+                (*okuri ? file.okuriAri
+                        : file.okuriNasi)[std::string(line.substr(0, space))];
+            auto &candidates = entry.candidates;
+            if (*okuri) {
+                entry.okuriBlocks.append(okuriBlocks(line.substr(space + 1)));
+            }
+            for (const auto &[text, annotation] :
+                 splitCandidates(line.substr(space + 1))) {
+                if (std::none_of(candidates.begin(), candidates.end(),
+                                 [text = unquoteCandidate(text)](
+                                     const auto &candidate) {
+                                     return candidate.text == text;
+                                 })) {
+                    candidates.push_back(
+                        {unquoteCandidate(text), unquoteCandidate(annotation)});
+                }
+            }
+        });
+    }
+
+    // Apply the journal if it belongs to the current file.
+    bool replay(std::string_view journal) {
+        auto end = journal.find('\n');
+        auto header = journal.substr(0, end);
+        if (end == std::string_view::npos ||
+            !stringutils::consumePrefix(header, journalHeader) ||
+            std::strtoull(std::string(header).data(), nullptr, 10) !=
+                generation_) {
+            return false;
+        }
+        forEachLine(journal.substr(end + 1), [this](std::string_view line) {
+            auto fields = stringutils::split(
+                line, "\t", stringutils::SplitBehavior::KeepEmpty);
+            if (fields.size() != 5 || fields[1].size() != 1) {
+                return;
+            }
+            const bool okuri = fields[1] == "1";
+            const auto midasi = unescape(fields[2]);
+            if (fields[0] == "S") {
+                applySelect(midasi, okuri,
+                            {unescape(fields[3]), unescape(fields[4])});
+            } else if (fields[0] == "P") {
+                applyPurge(midasi, okuri, unescape(fields[3]));
+            } else {
+                return;
+            }
+            journalRecords_ += 1;
+        });
+        return true;
+    }
+
+    // Same as SkkUserDict, a known candidate is swapped with the first one
+    // and a new one is inserted at the front.
+    bool applySelect(const std::string &midasi, bool okuri,
+                     UserCandidate candidate) {
+        auto &candidates = (okuri ? okuriAri_ : okuriNasi_)[midasi].candidates;
+        auto iter = std::find_if(candidates.begin(), candidates.end(),
+                                 [&candidate](const auto &item) {
+                                     return item.text == candidate.text;
+                                 });
+        if (iter == candidates.begin() && iter != candidates.end()) {
+            return false;
+        }
+        if (iter != candidates.end()) {
+            std::iter_swap(candidates.begin(), iter);
+        } else {
+            candidates.insert(candidates.begin(), std::move(candidate));
+        }
+        return true;
+    }
+
+    bool applyPurge(const std::string &midasi, bool okuri,
+                    const std::string &text) {
+        auto &entries = okuri ? okuriAri_ : okuriNasi_;
+        auto entry = entries.find(midasi);
+        if (entry == entries.end()) {
+            return false;
+        }
+        auto &candidates = entry->second.candidates;
+        auto size = candidates.size();
+        std::erase_if(candidates,
+                      [&text](const auto &item) { return item.text == text; });
+        if (candidates.size() == size) {
+            return false;
+        }
+        if (candidates.empty()) {
+            entries.erase(entry);
+        }
+        return true;
+    }
+
+    bool openJournal(bool reset) {
+        fs::makePath(std::filesystem::path(journalPath_).parent_path());
+        journal_ = UnixFD::own(::open(
+            journalPath_.data(),
+            O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (reset ? O_TRUNC : 0),
+            0600));
+        if (!journal_.isValid()) {
+            return false;
+        }
+        if (reset) {
+            journalRecords_ = 0;
+            const auto header =
+                stringutils::concat(journalHeader, generation_, "\n");
+            if (fs::safeWrite(journal_.fd(), header.data(), header.size()) !=
+                    static_cast<ssize_t>(header.size()) ||
+                ::fdatasync(journal_.fd()) != 0) {
+                journal_.reset();
+                return false;
+            }
+            syncParentDirectory(journalPath_);
+        }
+        return true;
+    }
+
+    // Called on the key path, so the journal is never merged here, save()
+    // does that. The record is not synced either, only its writeback is
+    // started, a crash of fcitx keeps it and the next save() makes it
+    // durable.
+    void appendJournal(const std::string &record) {
+        journalRecords_ += 1;
+        if (!journal_.isValid() ||
+            fs::safeWrite(journal_.fd(), record.data(), record.size()) !=
+                static_cast<ssize_t>(record.size())) {
+            // Without journal, the change is only kept by the next save.
+            SKK_DEBUG() << "Failed to write journal " << journalPath_;
+            journal_.reset();
+            return;
+        }
+        ::sync_file_range(journal_.fd(), 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+
+    std::string serialize(uint64_t generation) const {
+        std::string content;
+        auto appendLine = [this, &content](const std::string &line) {
+            if (auto encoded =
+                    convertEncoding(line, encoding_.data(), "UTF-8")) {
+                content.append(*encoded);
+            } else {
+                SKK_DEBUG() << "Skip entry that can not be encoded in "
+                            << encoding_ << ": " << line;
+            }
+        };
+        auto appendEntry = [&appendLine](const std::string &midasi,
+                                         const UserEntry &entry) {
+            std::string line = stringutils::concat(midasi, " /");
+            for (const auto &candidate : entry.candidates) {
+                line.append(quoteCandidate(candidate.text));
+                if (!candidate.annotation.empty()) {
+                    line.push_back(';');
+                    line.append(quoteCandidate(candidate.annotation));
+                }
+                line.push_back('/');
+            }
+            line.append(entry.okuriBlocks);
+            line.push_back('\n');
+            appendLine(line);
+        };
+
+        appendLine(stringutils::concat(generationMarker, generation, "\n"));
+        for (const auto &line : otherLines_) {
+            appendLine(stringutils::concat(line, "\n"));
+        }
+        appendLine(stringutils::concat(okuriAriMarker, "\n"));
+        for (auto iter = okuriAri_.rbegin(); iter != okuriAri_.rend();
+             ++iter) {
+            appendEntry(iter->first, iter->second);
+        }
+        appendLine(stringutils::concat(okuriNasiMarker, "\n"));
+        for (const auto &[midasi, entry] : okuriNasi_) {
+            appendEntry(midasi, entry);
+        }
+        return content;
+    }
+
+    const std::string path_;
+    const std::string encoding_;
+    const std::string journalPath_;
+    UserEntries okuriAri_;
+    UserEntries okuriNasi_;
+    std::vector<std::string> otherLines_;
+    uint64_t generation_ = 0;
+    UnixFD journal_;
+    size_t journalRecords_ = 0;
+};
+
+struct FcitxSkkUserDict {
+    SkkDict parent_instance;
+    UserDictionary *dictionary;
+};
+
+struct FcitxSkkUserDictClass {
+    SkkDictClass parent_class;
+};
+
+G_DEFINE_TYPE(FcitxSkkUserDict, fcitx_skk_user_dict, SKK_TYPE_DICT)
+
+FcitxSkkUserDict *toUserDict(SkkDict *dict) {
+    return reinterpret_cast<FcitxSkkUserDict *>(dict);
+}
+
+void fcitx_skk_user_dict_finalize(GObject *object) {
+    auto *self = reinterpret_cast<FcitxSkkUserDict *>(object);
+    delete self->dictionary;
+    G_OBJECT_CLASS(fcitx_skk_user_dict_parent_class)->finalize(object);
+}
+
+void fcitx_skk_user_dict_reload(SkkDict *dict, GError **error) {
+    toUserDict(dict)->dictionary->load(error);
+}
+
+SkkCandidate **fcitx_skk_user_dict_lookup(SkkDict *dict, const gchar *midasi,
+                                          gboolean okuri, gint *length) {
+    auto *self = toUserDict(dict);
+    std::vector<SkkCandidate *> result;
+    if (const auto *candidates = self->dictionary->find(midasi, okuri)) {
+        for (const auto &candidate : *candidates) {
+            result.push_back(skk_candidate_new(
+                midasi, okuri, candidate.text.data(),
+                candidate.annotation.empty() ? nullptr
+                                             : candidate.annotation.data(),
+                candidate.text.data()));
+        }
+    }
+    return newCandidateArray(result, length);
+}
+
+gchar **fcitx_skk_user_dict_complete(SkkDict *dict, const gchar *midasi,
+                                     gint *length) {
+    auto *self = toUserDict(dict);
+    return newStringArray(self->dictionary->complete(midasi), length);
+}
+
+gboolean fcitx_skk_user_dict_select_candidate(SkkDict *dict,
+                                              SkkCandidate *candidate) {
+    auto *self = toUserDict(dict);
+    const auto *annotation = skk_candidate_get_annotation(candidate);
+    return self->dictionary->select(
+        skk_candidate_get_midasi(candidate),
+        skk_candidate_get_okuri(candidate),
+        {skk_candidate_get_text(candidate), annotation ? annotation : ""});
+}
+
+gboolean fcitx_skk_user_dict_purge_candidate(SkkDict *dict,
+                                             SkkCandidate *candidate) {
+    auto *self = toUserDict(dict);
+    return self->dictionary->purge(skk_candidate_get_midasi(candidate),
+                                   skk_candidate_get_okuri(candidate),
+                                   skk_candidate_get_text(candidate));
+}
+
+void fcitx_skk_user_dict_save(SkkDict *dict, GError ** /*error*/) {
+    toUserDict(dict)->dictionary->save();
+}
+
+gboolean fcitx_skk_user_dict_get_read_only(SkkDict * /*dict*/) {
+    return FALSE;
+}
+
+void fcitx_skk_user_dict_init(FcitxSkkUserDict * /*self*/) {}
+
+void fcitx_skk_user_dict_class_init(FcitxSkkUserDictClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = fcitx_skk_user_dict_finalize;
+    auto *dictClass = SKK_DICT_CLASS(klass);
+    dictClass->reload = fcitx_skk_user_dict_reload;
+    dictClass->lookup = fcitx_skk_user_dict_lookup;
+    dictClass->complete = fcitx_skk_user_dict_complete;
+    dictClass->select_candidate = fcitx_skk_user_dict_select_candidate;
+    dictClass->purge_candidate = fcitx_skk_user_dict_purge_candidate;
+    dictClass->save = fcitx_skk_user_dict_save;
+    dictClass->get_read_only = fcitx_skk_user_dict_get_read_only;
+}
+
+} // namespace
+
+SkkDict *newUserDict(const std::string &path, const std::string &encoding) {
+    auto dictionary = std::make_unique<UserDictionary>(path, encoding);
+    if (!dictionary->load(nullptr)) {
+        return nullptr;
+    }
+    auto *self = static_cast<FcitxSkkUserDict *>(
+        g_object_new(fcitx_skk_user_dict_get_type(), nullptr));
+    self->dictionary = dictionary.release();
+    return SKK_DICT(self);
+}
+
+} // namespace fcitx
@@ -0,0 +1,24 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+#ifndef _FCITX_SKK_USERDICT_H_
+#define _FCITX_SKK_USERDICT_H_
+
+#include <string>
+#include <libskk/libskk.h>
+
+namespace fcitx {
+
+// Create a readwrite dictionary compatible with the user dictionary of
+// libskk. Every learned or purged candidate is appended to a journal next to
+// the file, path + ".journal", and the journal is merged into the file when
+// the dictionary is saved. Returns nullptr if the existing file can not be
+// read.
+SkkDict *newUserDict(const std::string &path, const std::string &encoding);
+
+} // namespace fcitx
+
+#endif // _FCITX_SKK_USERDICT_H_
@@ -0,0 +1,205 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+// Types plain kana and short readings through skk once the caches are warm,
+// and checks that the key path does not allocate. Only C++ allocations of the
+// main thread are counted, the ones of libskk and glib go through malloc and
+// are not made by fcitx5-skk.
+//
+// This only covers preedit segments short enough for the small string
+// optimization, with PredictiveCompletion off. A longer reading allocates a
+// string per segment, Text has no way to reuse them, and a prediction query
+// allocates its prefix and callback.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/eventloopinterface.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/event.h>
+#include <fcitx/inputcontext.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+#include "benchmarkutils.h"
+#include "testdir.h"
+#include "testfrontend_public.h"
+
+using namespace fcitx;
+
+namespace {
+
+thread_local bool countAllocations = false;
+uint64_t allocations = 0;
+
+} // namespace
+
+void *operator new(std::size_t size) {
+    if (countAllocations) {
+        allocations += 1;
+    }
+    if (auto *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t /*size*/) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+// Each round types "あいうえお" and "かきく", then "▽かな" that is
+// committed with Return. Every key is pressed and released. No preedit
+// segment is longer than 15 bytes, see above.
+const char *const keys[] = {
+    "a", "i", "u", "e", "o", "k", "a", "k", "i", "k", "u",
+    "Shift+K", "a", "n", "a", "Return",
+};
+
+constexpr int warmUpRounds = 3;
+constexpr int rounds = 20;
+// Event loop iterations after the last key, so its input panel update is
+// counted no matter which deferred event runs first.
+constexpr int drainSteps = 2;
+
+// Sends one key per event loop iteration, so the input panel update that
+// skk defers runs between keys. Scheduling the next key is a oneshot event
+// that is created once, so the test itself does not allocate either.
+class AllocationTest {
+public:
+    AllocationTest(Instance *instance) : instance_(instance) {
+        for (const auto *key : keys) {
+            keys_.emplace_back(key);
+            FCITX_ASSERT(keys_.back().isValid());
+        }
+    }
+
+    void start() {
+        auto defaultGroup = instance_->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(InputMethodGroupItem("skk"));
+        defaultGroup.setDefaultInputMethod("");
+        instance_->inputMethodManager().setGroup(defaultGroup);
+
+        auto *testfrontend = instance_->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        ic_ = instance_->inputContextManager().findByUUID(uuid);
+        FCITX_ASSERT(ic_);
+        ic_->setCapabilityFlags(CapabilityFlag::Preedit);
+        testfrontend->call<ITestFrontend::sendKeyEvent>(
+            uuid, Key("Control+space"), false);
+        FCITX_ASSERT(instance_->inputMethod(ic_) == "skk");
+
+        step_ = instance_->eventLoop().addDeferEvent([this](EventSource *) {
+            runStep();
+            return true;
+        });
+    }
+
+private:
+    void runStep() {
+        if (index_ == keys_.size()) {
+            index_ = 0;
+            round_ += 1;
+            if (round_ == warmUpRounds) {
+                countAllocations = true;
+            }
+        }
+        if (round_ == warmUpRounds + rounds) {
+            if (drained_++ < drainSteps) {
+                step_->setOneShot();
+                return;
+            }
+            countAllocations = false;
+            finish();
+            return;
+        }
+        const auto &key = keys_[index_++];
+        KeyEvent press(ic_, key, false);
+        ic_->keyEvent(press);
+        KeyEvent release(ic_, key, true);
+        ic_->keyEvent(release);
+        step_->setOneShot();
+    }
+
+    void finish() {
+        std::cout << "allocations in " << rounds * keys_.size()
+                  << " keys: " << allocations << std::endl;
+        FCITX_ASSERT(allocations == 0);
+        instance_->exit();
+    }
+
+    Instance *instance_;
+    std::vector<Key> keys_;
+    InputContext *ic_ = nullptr;
+    std::unique_ptr<EventSource> step_;
+    size_t index_ = 0;
+    int round_ = 0;
+    int drained_ = 0;
+};
+
+} // namespace
+
+int main() {
+    char tempDir[] = "/tmp/skk-test-XXXXXX";
+    FCITX_ASSERT(mkdtemp(tempDir));
+    const std::filesystem::path home = tempDir;
+    // Plain kana and a reading committed as is need no dictionary, the
+    // user dictionary in the temporary home keeps the test self-contained.
+    FCITX_ASSERT(writeFile(home / "skk/dictionary_list",
+                           "type=file,file=$FCITX_CONFIG_DIR/skk/user.dict,"
+                           "mode=readwrite\n"));
+    FCITX_ASSERT(writeFile(home / "conf/skk.conf",
+                           "LoadDictionaryInBackground=False\n"
+                           "PredictiveCompletion=False\n"));
+
+    setupTestingEnvironment(TESTING_BINARY_DIR, {SKK_ADDON_DIR},
+                            {TESTING_BINARY_DIR});
+    setenv("FCITX_CONFIG_HOME", tempDir, 1);
+    setenv("FCITX_DATA_HOME", tempDir, 1);
+    Log::setLogRule("default=3");
+
+    char arg0[] = "testallocation";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,skk";
+    char *argv[] = {arg0, arg1, arg2};
+    Instance instance(FCITX_ARRAY_SIZE(argv), argv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    AllocationTest test(&instance);
+    EventDispatcher dispatcher;
+    dispatcher.attach(&instance.eventLoop());
+    dispatcher.schedule([&instance, &test]() {
+        FCITX_ASSERT(instance.addonManager().addon("skk", true));
+        test.start();
+    });
+    instance.exec();
+
+    std::error_code ec;
+    std::filesystem::remove_all(home, ec);
+    return 0;
+}